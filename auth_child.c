@@ -16,14 +16,23 @@ limitations under the License.
 
 #include "auth_child.h"
 
+#include <errno.h>   // for errno, EINTR
+#include <fcntl.h>   // for fcntl, FD_CLOEXEC, F_GETFL, F_SETFL, O_NONBLOCK
+#include <signal.h>  // for SIGTERM
+#include <stdio.h>   // for snprintf
 #include <stdlib.h>  // for NULL, EXIT_FAILURE
-#include <string.h>  // for strlen
-#include <unistd.h>  // for close, _exit, dup2, execl, fork, pipe
+#include <string.h>  // for memcpy, memmove, strlen
+#include <unistd.h>  // for close, pipe, write
 
+#include "auth_control.h"      // for AUTH_CONTROL_ESCAPE, AUTH_CONTROL_SHOW
+#include "child_cgroup.h"      // for GetChildCgroupSetup, CHILD_CGROUP_AUTH
 #include "env_settings.h"      // for GetIntSetting
 #include "logging.h"           // for LogErrno, Log
+#include "restart_policy.h"    // for RecordChildExit, MayStartChild
+#include "secure_arena.h"      // for SecureAlloc
+#include "util.h"              // for explicit_bzero
 #include "wait_pgrp.h"         // for KillPgrp, WaitPgrp
-#include "xscreensaver_api.h"  // for ExportWindowID
+#include "xscreensaver_api.h"  // for FormatWindowIDEnv
 
 //! The PID of a currently running saver child, or 0 if none is running.
 static pid_t auth_child_pid = 0;
@@ -31,6 +40,41 @@ static pid_t auth_child_pid = 0;
 //! If auth_child_pid != 0, the FD which connects to stdin of the auth child.
 static int auth_child_fd = 0;
 
+//! If auth_child_pid != 0 and the auth child is persistent, the FD on which
+//! the auth child reports back to us; -1 otherwise.
+static int auth_child_status_fd = -1;
+
+//! If auth_child_pid != 0, whether the auth child has been shown, i.e. is not
+//! merely a warm standby.
+static int auth_child_active = 0;
+
+//! The maximum number of bytes waiting to be sent to the auth child.
+#define AUTH_CHILD_QUEUE_SIZE 1024
+
+//! Data waiting to be sent to the auth child, as it may not be reading right
+//! now. This may contain parts of the password, so it is allocated in the
+//! secure arena by LockAuthChildQueue().
+static struct {
+  char buf[AUTH_CHILD_QUEUE_SIZE];
+  size_t len;
+} *auth_child_queue;
+
+//! Whether the auth child was killed for not reading its input, but was not
+//! reaped yet. Nothing is queued for it in the meantime.
+static int auth_child_stalled = 0;
+
+//! Whether a standby auth child died before being shown. If so, no new one
+//! is started in standby until an auth child was shown again.
+static int standby_failed = 0;
+
+//! The maximum delay between restarts of an auth child in standby.
+#define AUTH_RESTART_MAX_DELAY_MS 5000
+
+//! The restart state of the auth child. Only starting one in standby is
+//! delayed, as showing the auth dialog is what the user asked for.
+static RestartPolicy auth_restart = {
+    .max_delay_ms = AUTH_RESTART_MAX_DELAY_MS};
+
 void KillAuthChildSigHandler(int signo) {
   // This is a signal handler, so we're not going to make this too complicated.
   // Just kill it.
@@ -39,29 +83,133 @@ void KillAuthChildSigHandler(int signo) {
   }
 }
 
-/*! \brief Return whether the wake-up keypress should be discarded and not be
- * sent to the auth child.
- *
- * Sending the wake-up keypress to the auth child is usually a bad idea because
- * many people use "any" key, not their password's, to wake up the screen saver.
- * Also, when using a blanking screen saver, one can't easily distinguish a
- * locked screen from a turned-off screen, and may thus accidentally start
- * entering the password into a web browser or similar "bad" place.
- *
- * However, it was requested by a user, so why not add it. Usage:
+//! The settings of the auth child, loaded once by LoadAuthChildSettings().
+static struct {
+  /*! \brief Whether the wake-up keypress should be discarded and not be sent
+   * to the auth child.
+   *
+   * Sending the wake-up keypress to the auth child is usually a bad idea
+   * because many people use "any" key, not their password's, to wake up the
+   * screen saver. Also, when using a blanking screen saver, one can't easily
+   * distinguish a locked screen from a turned-off screen, and may thus
+   * accidentally start entering the password into a web browser or similar
+   * "bad" place.
+   *
+   * However, it was requested by a user, so why not add it. Usage:
+   *
+   * XSECURELOCK_DISCARD_FIRST_KEYPRESS=0 xsecurelock
+   */
+  int discard_first_keypress;
+
+  /*! \brief Whether an auth child should be kept in warm standby.
+   *
+   * If enabled, an auth child is started in advance and only shown once it is
+   * needed. This hides its startup time (connecting to X11, loading fonts etc.)
+   * from the user.
+   */
+  int warm_standby;
+
+  /*! \brief Whether the auth child should survive failed attempts.
+   *
+   * If enabled, a failed authentication attempt merely hides the auth child,
+   * which is then shown again for the next attempt.
+   */
+  int persistent;
+} settings;
+
+void LoadAuthChildSettings(void) {
+  settings.discard_first_keypress =
+      GetIntSetting("XSECURELOCK_DISCARD_FIRST_KEYPRESS",
+                    !GetIntSetting("XSECURELOCK_WANT_FIRST_KEYPRESS", 0));
+  settings.warm_standby = GetIntSetting("XSECURELOCK_AUTH_WARM_STANDBY", 0);
+  settings.persistent = GetIntSetting("XSECURELOCK_AUTH_PERSISTENT", 0);
+}
+
+//! Makes fd close-on-exec, so it is not inherited by any child process.
+static void SetCloexec(int fd) {
+  int flags = fcntl(fd, F_GETFD);
+  if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+    LogErrno("fcntl(FD_CLOEXEC)");
+  }
+}
+
+int LockAuthChildQueue(void) {
+  if (auth_child_queue == NULL) {
+    auth_child_queue = SecureAlloc(sizeof(*auth_child_queue));
+  }
+  return auth_child_queue != NULL ? 0 : -1;
+}
+
+//! Discards all data queued for the auth child.
+static void ClearAuthChildQueue(void) {
+  explicit_bzero(auth_child_queue->buf, auth_child_queue->len);
+  auth_child_queue->len = 0;
+}
+
+/*! \brief Appends data to the queue for the auth child.
  *
- * XSECURELOCK_DISCARD_FIRST_KEYPRESS=0 xsecurelock
+ * The data is queued either entirely or not at all, so a control command is
+ * never split. If it does not fit, the auth child is not reading its input;
+ * as dropping data would lose parts of the password, it gets restarted
+ * instead. The data is actually sent by FlushAuthChildQueue().
  */
-static int DiscardFirstKeypress() {
-  return GetIntSetting("XSECURELOCK_DISCARD_FIRST_KEYPRESS",
-                       !GetIntSetting("XSECURELOCK_WANT_FIRST_KEYPRESS", 0));
+static void QueueForAuthChild(const char *data, size_t len) {
+  if (auth_child_stalled) {
+    // Being restarted; WatchAuthChild() will notice once it exited.
+    return;
+  }
+  if (len > sizeof(auth_child_queue->buf) - auth_child_queue->len) {
+    Log("Auth child is not reading its input. Restarting it");
+    ClearAuthChildQueue();
+    auth_child_stalled = 1;
+    if (KillPgrp(auth_child_pid, SIGTERM) < 0) {
+      LogErrno("KillPgrp auth");
+    }
+    return;
+  }
+  memcpy(auth_child_queue->buf + auth_child_queue->len, data, len);
+  auth_child_queue->len += len;
+}
+
+void FlushAuthChildQueue(void) {
+  if (auth_child_pid == 0) {
+    ClearAuthChildQueue();
+    return;
+  }
+  while (auth_child_queue->len != 0) {
+    ssize_t written =
+        write(auth_child_fd, auth_child_queue->buf, auth_child_queue->len);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // Try again once GetAuthChildQueueFd() becomes writable.
+        return;
+      }
+      LogErrno("Failed to send all data to the auth child");
+      ClearAuthChildQueue();
+      return;
+    }
+    size_t remaining = auth_child_queue->len - (size_t)written;
+    memmove(auth_child_queue->buf, auth_child_queue->buf + written, remaining);
+    explicit_bzero(auth_child_queue->buf + remaining, (size_t)written);
+    auth_child_queue->len = remaining;
+  }
+}
+
+int GetAuthChildQueueFd(void) {
+  if (auth_child_pid == 0 || auth_child_queue->len == 0) {
+    return -1;
+  }
+  return auth_child_fd;
 }
 
 int WantAuthChild(int force_auth) {
   if (force_auth) {
     return 1;
   }
-  return (auth_child_pid != 0);
+  return (auth_child_pid != 0 && auth_child_active);
 }
 
 /*! \brief Return whether buf contains exclusively control characters.
@@ -93,61 +241,171 @@ static int ContainsNonControl(const char *buf) {
   return 0;
 }
 
+/*! \brief Sends a control command to the auth child.
+ *
+ * \param command The command, one of the AUTH_CONTROL_* command bytes.
+ */
+static void SendAuthControl(char command) {
+  char buf[2] = {AUTH_CONTROL_ESCAPE, command};
+  QueueForAuthChild(buf, sizeof(buf));
+}
+
+int GetAuthChildStatusFd(void) { return auth_child_status_fd; }
+
+const RestartPolicy *GetAuthChildRestartPolicy(void) { return &auth_restart; }
+
+/*! \brief Reads reports from a persistent auth child.
+ *
+ * If the auth child hid itself, it returns to standby.
+ */
+static void ReadAuthChildStatus(void) {
+  if (auth_child_status_fd == -1) {
+    return;
+  }
+  char buf[16];
+  for (;;) {
+    ssize_t got = read(auth_child_status_fd, buf, sizeof(buf));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      // EAGAIN or EOF. On EOF, the child is dying - WaitPgrp will notice.
+      return;
+    }
+    for (ssize_t i = 0; i < got; ++i) {
+      if (buf[i] == AUTH_CONTROL_HIDE) {
+        auth_child_active = 0;
+      }
+    }
+  }
+}
+
 int WatchAuthChild(Window w, const char *executable, int force_auth,
                    const char *stdinbuf, int *auth_running) {
+  ReadAuthChildStatus();
+
   if (auth_child_pid != 0) {
     // Check if auth child returned.
     int status;
     if (WaitPgrp("auth", &auth_child_pid, 0, 0, &status)) {
+      // An active auth child exiting normally just failed to authenticate
+      // (wrong password, Escape or timeout), which is no reason to back off.
+      RecordChildExit(&auth_restart, "Auth", status,
+                      auth_child_active && status >= 0);
+
       // Clean up.
+      ClearAuthChildQueue();
+      auth_child_stalled = 0;
       close(auth_child_fd);
+      if (auth_child_status_fd != -1) {
+        close(auth_child_status_fd);
+        auth_child_status_fd = -1;
+      }
 
-      // Handle success; this will exit the screen lock.
-      if (status == 0) {
+      // Handle success; this will exit the screen lock. A standby auth child
+      // never got to authenticate, so its exit status is meaningless.
+      if (status == 0 && auth_child_active) {
         *auth_running = 0;
         return 1;
       }
+      if (!auth_child_active) {
+        // Avoid a respawn loop if the auth child cannot even start up.
+        Log("Auth child died in standby - not keeping one in standby");
+        standby_failed = 1;
+      }
 
       // To handle failure, we just fall through, as we may want to immediately
       // launch a new auth child and send it a keypress.
     }
   }
 
-  if (force_auth && auth_child_pid == 0) {
+  if (force_auth && auth_child_pid != 0 && !auth_child_active) {
+    // Activate the standby (or hidden persistent) auth child.
+    SendAuthControl(AUTH_CONTROL_SHOW);
+    auth_child_active = 1;
+    if (stdinbuf != NULL && (settings.discard_first_keypress ||
+                             !ContainsNonControl(stdinbuf))) {
+      // Same as below - the auth child is only just being shown.
+      stdinbuf = NULL;
+    }
+  }
+
+  // Start a new auth child when needed, or keep one in standby.
+  if (force_auth) {
+    standby_failed = 0;
+  }
+  int start_standby =
+      !force_auth && !standby_failed && settings.warm_standby;
+  if ((force_auth || (start_standby && MayStartChild(&auth_restart))) &&
+      auth_child_pid == 0) {
     // Start auth child.
-    int pc[2];
+    int persistent = settings.persistent;
+    int pc[2], status_pc[2] = {-1, -1};
     if (pipe(pc)) {
       LogErrno("pipe");
+    } else if (persistent && pipe(status_pc)) {
+      LogErrno("pipe");
+      close(pc[0]);
+      close(pc[1]);
     } else {
-      pid_t pid = ForkWithoutSigHandlers();
+      // Our ends of the pipes must not be inherited.
+      SetCloexec(pc[1]);
+      if (persistent) {
+        SetCloexec(status_pc[0]);
+      }
+      char window_env[XSCREENSAVER_ENV_SIZE];
+      FormatWindowIDEnv(window_env, w);
+      char status_fd_env[64];
+      snprintf(status_fd_env, sizeof(status_fd_env), "%s=%d",
+               AUTH_CONTROL_PERSISTENT_ENV, status_pc[1]);
+      const char *env[4] = {window_env, NULL, NULL, NULL};
+      int n_env = 1;
+      if (start_standby) {
+        env[n_env++] = AUTH_CONTROL_STANDBY_ENV "=1";
+      }
+      if (persistent) {
+        env[n_env++] = status_fd_env;
+      }
+      const char *args[2] = {executable, NULL};
+      SpawnOptions options = {pc[0], -1, /*new_pgrp=*/1, env,
+                              GetChildCgroupSetup(CHILD_CGROUP_AUTH)};
+      pid_t pid = SpawnHelper(executable, args, &options);
+      RecordChildStart(&auth_restart);
       if (pid == -1) {
-        LogErrno("fork");
-      } else if (pid == 0) {
-        // Child process.
-        StartPgrp();
-        ExportWindowID(w);
+        RecordChildExit(&auth_restart, "Auth", EXIT_FAILURE, 0);
+        close(pc[0]);
         close(pc[1]);
-        if (pc[0] != 0) {
-          if (dup2(pc[0], 0) == -1) {
-            LogErrno("dup2");
-            _exit(EXIT_FAILURE);
-          }
-          close(pc[0]);
-        }
-        {
-          const char *args[2] = {executable, NULL};
-          ExecvHelper(executable, args);
-          sleep(2);  // Reduce log spam or other effects from failed execv.
-          _exit(EXIT_FAILURE);
+        if (persistent) {
+          close(status_pc[0]);
+          close(status_pc[1]);
         }
       } else {
-        // Parent process after successful fork.
+        // Parent process after successful spawn.
         close(pc[0]);
+        // Never block on a stalled auth child; FlushAuthChildQueue() retries.
+        int flags = fcntl(pc[1], F_GETFL);
+        if (flags == -1 || fcntl(pc[1], F_SETFL, flags | O_NONBLOCK) == -1) {
+          LogErrno("fcntl(O_NONBLOCK)");
+        }
         auth_child_fd = pc[1];
         auth_child_pid = pid;
+        auth_child_active = !start_standby;
+        if (persistent) {
+          close(status_pc[1]);
+          flags = fcntl(status_pc[0], F_GETFL);
+          if (flags == -1 ||
+              fcntl(status_pc[0], F_SETFL, flags | O_NONBLOCK) == -1) {
+            LogErrno("fcntl(O_NONBLOCK)");
+          }
+          auth_child_status_fd = status_pc[0];
+          if (!start_standby) {
+            // A persistent auth child always waits to be shown.
+            SendAuthControl(AUTH_CONTROL_SHOW);
+          }
+        }
 
-        if (stdinbuf != NULL &&
-            (DiscardFirstKeypress() || !ContainsNonControl(stdinbuf))) {
+        if (stdinbuf != NULL && (settings.discard_first_keypress ||
+                                 !ContainsNonControl(stdinbuf))) {
           // The auth child has just been started. Do not send any keystrokes to
           // it immediately. Exception: when the user requested different
           // behavior by XSECURELOCK_DISCARD_FIRST_KEYPRESS=0 and there is a
@@ -158,19 +416,13 @@ int WatchAuthChild(Window w, const char *executable, int force_auth,
     }
   }
 
-  // Report whether the auth child is running.
-  *auth_running = (auth_child_pid != 0);
+  // Report whether the auth child is running (and not merely in standby).
+  *auth_running = (auth_child_pid != 0 && auth_child_active);
 
-  // Send the provided keyboard buffer to stdin.
+  // Queue the provided keyboard buffer for stdin.
   if (stdinbuf != NULL && stdinbuf[0] != 0) {
-    if (auth_child_pid != 0) {
-      ssize_t to_write = (ssize_t)strlen(stdinbuf);
-      ssize_t written = write(auth_child_fd, stdinbuf, to_write);
-      if (written < 0) {
-        LogErrno("Failed to send all data to the auth child");
-      } else if (written != to_write) {
-        Log("Failed to send all data to the auth child");
-      }
+    if (*auth_running) {
+      QueueForAuthChild(stdinbuf, strlen(stdinbuf));
     } else {
       Log("No auth child. Can't send key events");
     }
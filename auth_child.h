@@ -19,13 +19,23 @@ limitations under the License.
 
 #include <X11/X.h>  // for Window
 
+#include "restart_policy.h"  // for RestartPolicy
+
 /*! \brief Kill the auth child.
  *
  * This can be used from a signal handler.
  */
 void KillAuthChildSigHandler(int signo);
 
+/*! \brief Loads the settings of the auth child from the environment.
+ *
+ * Must be called once before any other function of this module.
+ */
+void LoadAuthChildSettings(void);
+
 /*! \brief Checks whether an auth child should be running.
+ *
+ * An auth child in warm standby does not count as running.
  *
  * \param force_auth If true, assume we want to start a new auth child.
  * \return true if an auth child is expected to be running after a call to
@@ -34,6 +44,14 @@ void KillAuthChildSigHandler(int signo);
 int WantAuthChild(int force_auth);
 
 /*! \brief Starts or stops the authentication child process.
+ *
+ * If XSECURELOCK_AUTH_WARM_STANDBY is set, this also keeps an auth child in
+ * standby while none is needed, and shows it instead of starting a new one once
+ * force_auth is set. Must thus be called regularly even if WantAuthChild(0) is
+ * false.
+ *
+ * If XSECURELOCK_AUTH_PERSISTENT is set, the auth child is not restarted after
+ * failed attempts; instead, it hides itself and gets shown again when needed.
  *
  * \param w The screen saver window. Will get cleared after auth child
  *   execution.
@@ -41,14 +59,50 @@ int WantAuthChild(int force_auth);
  *   be passed.
  * \param force_auth If true, the auth child will be spawned if not already
  *   running.
- * \param stdinbuf If non-NULL, this data will be sent to stdin of the auth
- *   child.
+ * \param stdinbuf If non-NULL, this data will be queued to be sent to stdin of
+ *   the auth child by FlushAuthChildQueue().
  * \param auth_running Will be set to the status of the current auth child (i.e.
- *   true iff it is running).
+ *   true iff it is running and not in standby).
  * \return true if authentication was successful, i.e. if the auth child exited
  *   with status zero.
  */
 int WatchAuthChild(Window w, const char *executable, int force_auth,
                    const char *stdinbuf, int *auth_running);
 
+/*! \brief Returns the FD on which a persistent auth child reports back.
+ *
+ * Becomes readable when the auth child hid itself after a failed attempt, at
+ * which point WatchAuthChild() should be called.
+ *
+ * \return The file descriptor, or -1 if there is none.
+ */
+int GetAuthChildStatusFd(void);
+
+/*! \brief Returns the restart state of the auth child.
+ *
+ * Starting an auth child in standby is delayed after quick failures.
+ */
+const RestartPolicy *GetAuthChildRestartPolicy(void);
+
+/*! \brief Allocates the queue of data for the auth child in the secure arena.
+ *
+ * Must be called after InitSecureArena(), and before any key presses are
+ * passed to WatchAuthChild().
+ *
+ * \return Zero if the operation succeeded.
+ */
+int LockAuthChildQueue(void);
+
+/*! \brief Sends as much queued data to the auth child as possible.
+ *
+ * Never blocks. Data that can't be written right away stays queued.
+ */
+void FlushAuthChildQueue(void);
+
+/*! \brief Returns the FD to wait on for writability while data is queued.
+ *
+ * \return The file descriptor, or -1 if nothing is queued.
+ */
+int GetAuthChildQueueFd(void);
+
 #endif
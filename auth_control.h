@@ -0,0 +1,52 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef AUTH_CONTROL_H
+#define AUTH_CONTROL_H
+
+/*! \brief The byte that introduces a control command on the auth child's stdin.
+ *
+ * The main program forwards key presses to the auth child as raw bytes taken
+ * from NUL-terminated strings, so they never contain this byte. A control
+ * command is this byte followed by one of the AUTH_CONTROL_* command bytes.
+ */
+#define AUTH_CONTROL_ESCAPE '\0'
+
+//! Command: show the auth dialog and start authenticating.
+#define AUTH_CONTROL_SHOW 's'
+
+//! Report: sent by persistent auth children to the main program once they hid
+//! the auth dialog after an authentication attempt.
+#define AUTH_CONTROL_HIDE 'h'
+
+/*! \brief Environment variable set for auth children started in standby.
+ *
+ * An auth child started with this set to 1 should perform all its
+ * initialization, but not show anything until it receives AUTH_CONTROL_SHOW.
+ */
+#define AUTH_CONTROL_STANDBY_ENV "XSECURELOCK_INSIDE_AUTH_STANDBY"
+
+/*! \brief Environment variable set for persistent auth children.
+ *
+ * Contains the number of a file descriptor the auth child reports to. An auth
+ * child started with this set does not exit when authentication failed;
+ * instead, it hides the auth dialog, writes AUTH_CONTROL_HIDE to this file
+ * descriptor and then behaves as if it were in standby, i.e. waits for
+ * AUTH_CONTROL_SHOW to try again. Implies AUTH_CONTROL_STANDBY_ENV.
+ */
+#define AUTH_CONTROL_PERSISTENT_ENV "XSECURELOCK_INSIDE_AUTH_PERSISTENT"
+
+#endif
@@ -0,0 +1,245 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// For SCHED_IDLE.
+#define _GNU_SOURCE
+
+#include "child_cgroup.h"
+
+#include <errno.h>         // for errno, EEXIST
+#include <fcntl.h>         // for open, O_WRONLY, O_CLOEXEC
+#include <limits.h>        // for PATH_MAX
+#include <sched.h>         // for sched_setscheduler, SCHED_IDLE
+#include <stdio.h>         // for NULL, snprintf, fopen, fgets, FILE
+#include <string.h>        // for strcmp, strcspn, strlen, strncmp
+#include <sys/resource.h>  // for setpriority, PRIO_PROCESS
+#include <sys/stat.h>      // for mkdir
+#include <unistd.h>        // for close, rmdir, write
+
+#include "env_settings.h"  // for GetIntSetting, GetStringSetting
+#include "logging.h"       // for Log, LogErrno
+
+//! Where the cgroup v2 hierarchy is mounted.
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+//! The settings, as loaded by InitChildCgroups().
+static struct {
+  //! Whether InitChildCgroups() has been called and isolation is enabled.
+  int enabled;
+  //! The cpu.max of the saver sub-group.
+  const char *saver_cpu_max;
+  //! The cpu.weight of the saver sub-group.
+  int saver_cpu_weight;
+  //! The memory.max of the saver sub-group.
+  const char *saver_memory_max;
+  //! The cpu.weight of our own and the auth sub-group.
+  int auth_cpu_weight;
+} settings;
+
+//! Whether the sub-groups below have been set up.
+static int have_cgroups = 0;
+
+//! The paths of our original cgroup and our sub-groups.
+static char own_cgroup[PATH_MAX], main_cgroup[PATH_MAX],
+    saver_cgroup[PATH_MAX], auth_cgroup[PATH_MAX];
+
+/*! \brief Writes a value to a cgroup control file.
+ *
+ * \return Zero if the operation succeeded.
+ */
+static int WriteCgroupFile(const char *dir, const char *file,
+                           const char *value) {
+  char path[PATH_MAX];
+  if ((size_t)snprintf(path, sizeof(path), "%s/%s", dir, file) >=
+      sizeof(path)) {
+    Log("Path too long: %s/%s", dir, file);
+    return -1;
+  }
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LogErrno("open %s", path);
+    return -1;
+  }
+  size_t len = strlen(value);
+  int ok = write(fd, value, len) == (ssize_t)len;
+  if (!ok) {
+    LogErrno("write %s to %s", value, path);
+  }
+  close(fd);
+  return ok ? 0 : -1;
+}
+
+/*! \brief Finds the cgroup v2 directory we are running in.
+ *
+ * \return Zero if the operation succeeded.
+ */
+static int GetOwnCgroup(char *buf, size_t size) {
+  FILE *f = fopen("/proc/self/cgroup", "r");
+  if (f == NULL) {
+    LogErrno("fopen /proc/self/cgroup");
+    return -1;
+  }
+  char line[PATH_MAX];
+  int found = 0;
+  while (!found && fgets(line, sizeof(line), f) != NULL) {
+    // The cgroup v2 hierarchy has the ID 0 and no controller list.
+    if (strncmp(line, "0::", 3)) {
+      continue;
+    }
+    line[strcspn(line, "\n")] = 0;
+    // Inside the root cgroup, there is nothing we may modify.
+    found = strcmp(line + 3, "/") &&
+            (size_t)snprintf(buf, size, CGROUP_ROOT "%s", line + 3) < size;
+  }
+  fclose(f);
+  return found ? 0 : -1;
+}
+
+//! Creates a sub-group, if it does not exist yet.
+static int MakeCgroup(char *path, size_t size, const char *parent,
+                      const char *name) {
+  if ((size_t)snprintf(path, size, "%s/%s", parent, name) >= size) {
+    Log("Path too long: %s/%s", parent, name);
+    return -1;
+  }
+  if (mkdir(path, 0755) && errno != EEXIST) {
+    LogErrno("mkdir %s", path);
+    return -1;
+  }
+  return 0;
+}
+
+/*! \brief Moves us back into our cgroup, undoing SetUpCgroups().
+ *
+ * Moving back requires the controllers to be disabled first. The sub-groups
+ * for children must have been removed already.
+ */
+static void RestoreOwnCgroup(void) {
+  if (WriteCgroupFile(own_cgroup, "cgroup.subtree_control", "-cpu -memory") ||
+      WriteCgroupFile(own_cgroup, "cgroup.procs", "0")) {
+    return;
+  }
+  rmdir(main_cgroup);
+}
+
+/*! \brief Sets up our sub-groups.
+ *
+ * As cgroups with enabled controllers must not contain processes themselves,
+ * we first move ourselves into a sub-group; this only works if nothing else
+ * runs in our cgroup, e.g. in a systemd user service with Delegate=yes.
+ *
+ * \return Zero if the operation succeeded.
+ */
+static int SetUpCgroups(void) {
+  if (GetOwnCgroup(own_cgroup, sizeof(own_cgroup)) ||
+      MakeCgroup(main_cgroup, sizeof(main_cgroup), own_cgroup,
+                 "xsecurelock-main")) {
+    return -1;
+  }
+  if (WriteCgroupFile(main_cgroup, "cgroup.procs", "0")) {
+    rmdir(main_cgroup);
+    return -1;
+  }
+  if (WriteCgroupFile(own_cgroup, "cgroup.subtree_control", "+cpu +memory")) {
+    // Other processes share our cgroup. Leave it as it was.
+    WriteCgroupFile(own_cgroup, "cgroup.procs", "0");
+    rmdir(main_cgroup);
+    return -1;
+  }
+  if (MakeCgroup(saver_cgroup, sizeof(saver_cgroup), own_cgroup,
+                 "xsecurelock-saver") ||
+      MakeCgroup(auth_cgroup, sizeof(auth_cgroup), own_cgroup,
+                 "xsecurelock-auth")) {
+    // Leave our cgroup as it was; rmdir fails for what was not created.
+    rmdir(saver_cgroup);
+    rmdir(auth_cgroup);
+    RestoreOwnCgroup();
+    return -1;
+  }
+  char weight[32];
+  snprintf(weight, sizeof(weight), "%d", settings.auth_cpu_weight);
+  WriteCgroupFile(main_cgroup, "cpu.weight", weight);
+  WriteCgroupFile(auth_cgroup, "cpu.weight", weight);
+  snprintf(weight, sizeof(weight), "%d", settings.saver_cpu_weight);
+  WriteCgroupFile(saver_cgroup, "cpu.weight", weight);
+  WriteCgroupFile(saver_cgroup, "cpu.max", settings.saver_cpu_max);
+  WriteCgroupFile(saver_cgroup, "memory.max", settings.saver_memory_max);
+  return 0;
+}
+
+void InitChildCgroups(void) {
+  settings.enabled = GetIntSetting("XSECURELOCK_CGROUPS", 0);
+  settings.saver_cpu_max =
+      GetStringSetting("XSECURELOCK_SAVER_CPU_MAX", "max");
+  settings.saver_cpu_weight =
+      GetIntSetting("XSECURELOCK_SAVER_CPU_WEIGHT", 10);
+  settings.saver_memory_max =
+      GetStringSetting("XSECURELOCK_SAVER_MEMORY_MAX", "max");
+  settings.auth_cpu_weight =
+      GetIntSetting("XSECURELOCK_AUTH_CPU_WEIGHT", 1000);
+  if (!settings.enabled) {
+    return;
+  }
+  have_cgroups = SetUpCgroups() == 0;
+  if (!have_cgroups) {
+    Log("Could not set up cgroups - only lowering the priority of savers");
+  }
+}
+
+//! Lowers the priority of the calling process as far as possible.
+static void LowerOwnPriority(void) {
+  // Both are inherited by processes the saver spawns later.
+  if (setpriority(PRIO_PROCESS, 0, 19)) {
+    LogErrno("setpriority");
+  }
+#ifdef SCHED_IDLE
+  struct sched_param param = {0};
+  if (sched_setscheduler(0, SCHED_IDLE, &param)) {
+    LogErrno("sched_setscheduler(SCHED_IDLE)");
+  }
+#endif
+}
+
+//! Moves the calling saver child into the saver sub-group.
+static void EnterSaverCgroup(void) {
+  WriteCgroupFile(saver_cgroup, "cgroup.procs", "0");
+}
+
+//! Moves the calling auth child into the auth sub-group.
+static void EnterAuthCgroup(void) {
+  WriteCgroupFile(auth_cgroup, "cgroup.procs", "0");
+}
+
+ChildCgroupSetup GetChildCgroupSetup(enum ChildCgroup group) {
+  if (!settings.enabled) {
+    return NULL;
+  }
+  if (have_cgroups) {
+    return group == CHILD_CGROUP_SAVER ? EnterSaverCgroup : EnterAuthCgroup;
+  }
+  return group == CHILD_CGROUP_SAVER ? LowerOwnPriority : NULL;
+}
+
+void ClearChildCgroups(void) {
+  if (!have_cgroups) {
+    return;
+  }
+  // Fails if something is still running in there; nothing we can do then.
+  rmdir(saver_cgroup);
+  rmdir(auth_cgroup);
+  // Leave our cgroup as we found it.
+  RestoreOwnCgroup();
+}
@@ -0,0 +1,62 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef CHILD_CGROUP_H
+#define CHILD_CGROUP_H
+
+//! The kinds of child processes that get resource limits of their own.
+enum ChildCgroup {
+  //! The saver child and all its descendants.
+  CHILD_CGROUP_SAVER,
+  //! The auth child and all its descendants.
+  CHILD_CGROUP_AUTH
+};
+
+/*! \brief Sets up resource isolation of child processes, if enabled.
+ *
+ * If XSECURELOCK_CGROUPS is set and our cgroup v2 has been delegated to us,
+ * this moves us into a sub-group of our cgroup, and creates sub-groups for
+ * savers and auth with the configured CPU and memory limits. Otherwise, if
+ * XSECURELOCK_CGROUPS is set, savers will merely run at the lowest priority.
+ *
+ * Must be called once at startup, before any child process is spawned.
+ */
+void InitChildCgroups(void);
+
+//! A function applying resource limits to the calling process.
+typedef void (*ChildCgroupSetup)(void);
+
+/*! \brief Returns how to apply the resource limits for a kind of child.
+ *
+ * The function returned is to be called in the new child before it executes
+ * anything (e.g. as SpawnOptions.before_exec), so that all processes the child
+ * spawns are affected too.
+ *
+ * \param group The kind of child process.
+ * \return The function, or NULL if no limits apply to this kind of child, or
+ *   if InitChildCgroups() has not been called.
+ */
+ChildCgroupSetup GetChildCgroupSetup(enum ChildCgroup group);
+
+/*! \brief Removes the sub-groups, if possible.
+ *
+ * Also moves us back into our original cgroup and disables the controllers
+ * InitChildCgroups() enabled there. Should be called at exit, after all child
+ * processes have terminated.
+ */
+void ClearChildCgroups(void);
+
+#endif
@@ -25,8 +25,24 @@ all_settings=$(
 	done | sort -u
 )
 
+# List of prefixes of settings patterns, such as XSECURELOCK_KEY_%s_COMMAND.
+# These show up in code matching the pattern, but are no settings themselves.
+pattern_prefixes='
+XSECURELOCK_KEY_
+'
+
+all_settings=$(
+	{
+		echo "$all_settings"
+		echo "$pattern_prefixes"
+		echo "$pattern_prefixes"
+	} | sort | uniq -u
+)
+
 # List of internal settings. These shall not be documented.
 internal_settings='
+XSECURELOCK_INSIDE_AUTH_PERSISTENT
+XSECURELOCK_INSIDE_AUTH_STANDBY
 XSECURELOCK_INSIDE_SAVER_MULTIPLEX
 '
 
@@ -58,6 +74,27 @@ documented_settings=$(
 
 status=0
 
+# List all settings known to CheckUnknownSettings().
+registered_settings=$(
+	<env_settings.c perl -ne '
+		print "$1\n" if /^\s+"(XSECURELOCK_[A-Za-z0-9_]+)",$/;
+	' | sort -u
+)
+
+unregistered_settings=$(
+	{
+		echo "$all_settings" | grep -v %
+		echo "$registered_settings"
+		echo "$registered_settings"
+	} | sort | uniq -u
+)
+if [ -n "$unregistered_settings" ]; then
+	echo "The following settings are missing in env_settings.c:"
+	echo "$unregistered_settings"
+	echo
+	status=1
+fi
+
 undocumented_settings=$(
 	{
 		echo "$public_settings"
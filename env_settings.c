@@ -19,11 +19,120 @@ limitations under the License.
 #include <errno.h>   // for errno, ERANGE
 #include <stdio.h>   // for fprintf, NULL, stderr
 #include <stdlib.h>  // for getenv, strtol, strtoull
-#include <string.h>  // for strchr
+#include <string.h>  // for strchr, strlen, strncmp
 #include <unistd.h>  // for access, X_OK
 
 #include "logging.h"
 
+//! The environment, for finding all settings.
+extern char** environ;
+
+//! The prefix of all settings.
+#define SETTING_PREFIX "XSECURELOCK_"
+
+//! The prefix and suffix of the XSECURELOCK_KEY_%s_COMMAND settings.
+#define KEY_COMMAND_PREFIX SETTING_PREFIX "KEY_"
+#define KEY_COMMAND_SUFFIX "_COMMAND"
+
+/*! \brief All settings read by XSecureLock or its helpers.
+ *
+ * Including internal and deprecated ones, as well as those only read by
+ * helpers not written in C. ensure-documented-settings.sh checks that this is
+ * complete.
+ *
+ * This is merely a list of names to detect misspelled settings; types and
+ * defaults stay with the code reading each setting. Each program or module
+ * reads its settings once at startup into plain variables (e.g. LoadDefaults()
+ * in main.c, LoadAuthChildSettings()), so that no hot path consults the
+ * environment.
+ */
+static const char* const known_settings[] = {
+    "XSECURELOCK_AUTH",
+    "XSECURELOCK_AUTHPROTO",
+    "XSECURELOCK_AUTH_CPU_WEIGHT",
+    "XSECURELOCK_AUTH_DOUBLE_BUFFER",
+    "XSECURELOCK_AUTH_PERSISTENT",
+    "XSECURELOCK_AUTH_SOUNDS",
+    "XSECURELOCK_AUTH_TIMEOUT",
+    "XSECURELOCK_AUTH_WARM_STANDBY",
+    "XSECURELOCK_BACKGROUND_COLOR",
+    "XSECURELOCK_BLANK_DPMS_STATE",
+    "XSECURELOCK_BLANK_TIMEOUT",
+    "XSECURELOCK_CGROUPS",
+    "XSECURELOCK_COMPOSITE_OBSCURER",
+    "XSECURELOCK_DATE_FORMAT",
+    "XSECURELOCK_DEBUG_ALLOW_LOCKING_IF_INEFFECTIVE",
+    "XSECURELOCK_DEBUG_FRAME_TIME",
+    "XSECURELOCK_DEBUG_LOCK_LATENCY",
+    "XSECURELOCK_DEBUG_SECURE_ARENA",
+    "XSECURELOCK_DEBUG_WINDOW_INFO",
+    "XSECURELOCK_DISCARD_FIRST_KEYPRESS",
+    "XSECURELOCK_FONT",
+    "XSECURELOCK_FORCE_GRAB",
+    "XSECURELOCK_FOREGROUND_COLOR",
+    "XSECURELOCK_GLOBAL_SAVER",
+    "XSECURELOCK_GRAB_RETRY_MAX_US",
+    "XSECURELOCK_GRAB_RETRY_MIN_US",
+    "XSECURELOCK_GRAB_TIMEOUT_MS",
+    "XSECURELOCK_INSIDE_AUTH_PERSISTENT",
+    "XSECURELOCK_INSIDE_AUTH_STANDBY",
+    "XSECURELOCK_INSIDE_SAVER_MULTIPLEX",
+    "XSECURELOCK_NO_COMPOSITE",
+    "XSECURELOCK_NO_PAM_RHOST",
+    "XSECURELOCK_PAM_ASYNC_SETCRED",
+    "XSECURELOCK_PAM_SERVICE",
+    "XSECURELOCK_PARANOID_PASSWORD",
+    "XSECURELOCK_PASSWORD_PROMPT",
+    "XSECURELOCK_SAVER",
+    "XSECURELOCK_SAVER_CPU_MAX",
+    "XSECURELOCK_SAVER_CPU_WEIGHT",
+    "XSECURELOCK_SAVER_DELAY_MS",
+    "XSECURELOCK_SAVER_MEMORY_MAX",
+    "XSECURELOCK_SAVER_RESET_ON_AUTH_CLOSE",
+    "XSECURELOCK_SAVER_STOP_ON_BLANK",
+    "XSECURELOCK_SHOW_LOCKS_AND_LATCHES",
+    "XSECURELOCK_TIME_FORMAT",
+    "XSECURELOCK_WANT_FIRST_KEYPRESS",
+    "XSECURELOCK_WARNING_COLOR",
+};
+
+/*! \brief Checks whether a variable assignment sets a known setting.
+ *
+ * \param var The variable assignment, in NAME=VALUE format.
+ * \param len The length of NAME.
+ */
+static int IsKnownSetting(const char* var, size_t len) {
+  for (size_t i = 0; i < sizeof(known_settings) / sizeof(*known_settings);
+       ++i) {
+    if (strlen(known_settings[i]) == len &&
+        !strncmp(var, known_settings[i], len)) {
+      return 1;
+    }
+  }
+  size_t prefix_len = strlen(KEY_COMMAND_PREFIX);
+  size_t suffix_len = strlen(KEY_COMMAND_SUFFIX);
+  return len > prefix_len + suffix_len &&
+         !strncmp(var, KEY_COMMAND_PREFIX, prefix_len) &&
+         !strncmp(var + len - suffix_len, KEY_COMMAND_SUFFIX, suffix_len);
+}
+
+int CheckUnknownSettings(void) {
+  int unknown = 0;
+  size_t prefix_len = strlen(SETTING_PREFIX);
+  for (char** env = environ; *env != NULL; ++env) {
+    if (strncmp(*env, SETTING_PREFIX, prefix_len)) {
+      continue;
+    }
+    const char* eq = strchr(*env, '=');
+    size_t len = eq ? (size_t)(eq - *env) : strlen(*env);
+    if (!IsKnownSetting(*env, len)) {
+      Log("Unknown setting %.*s", (int)len, *env);
+      ++unknown;
+    }
+  }
+  return unknown;
+}
+
 unsigned long long GetUnsignedLongLongSetting(const char* name,
                                               unsigned long long def) {
   const char* value = getenv(name);
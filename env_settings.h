@@ -17,6 +17,16 @@ limitations under the License.
 #ifndef ENV_SETTINGS_H
 #define ENV_SETTINGS_H
 
+/*! \brief Checks the environment for unknown settings.
+ *
+ * Logs all variables with the XSECURELOCK_ prefix that are not read by any
+ * part of XSecureLock, as they most likely are misspelled. They do not prevent
+ * locking the screen, as failing to lock over a typo is worse than the typo.
+ *
+ * \return The number of unknown settings.
+ */
+int CheckUnknownSettings(void);
+
 /*! \brief Loads an integer setting from the environment.
  *
  * \param name The setting to read (with XSECURELOCK_ variable name prefix).
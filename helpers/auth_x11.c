@@ -16,6 +16,8 @@ limitations under the License.
 
 #include <X11/X.h>     // for Success, None, Atom, KBBellPitch
 #include <X11/Xlib.h>  // for DefaultScreen, Screen, XFree, True
+#include <errno.h>     // for errno, EINTR
+#include <fcntl.h>     // for fcntl, FD_CLOEXEC, F_GETFD, F_SETFD
 #include <locale.h>    // for NULL, setlocale, LC_CTYPE, LC_TIME
 #include <stdio.h>
 #include <stdlib.h>      // for free, rand, mblen, size_t, EXIT_...
@@ -23,7 +25,7 @@ limitations under the License.
 #include <sys/select.h>  // for timeval, select, fd_set, FD_SET
 #include <sys/time.h>    // for gettimeofday, timeval
 #include <time.h>        // for time, nanosleep, localtime_r
-#include <unistd.h>      // for close, _exit, dup2, pipe, dup
+#include <unistd.h>      // for close, pipe
 
 #if __STDC_VERSION__ >= 199901L
 #include <inttypes.h>
@@ -42,12 +44,13 @@ limitations under the License.
 #include <X11/extensions/XKBstr.h>  // for _XkbDesc, XkbStateRec, _XkbControls
 #endif
 
+#include "../auth_control.h"      // for AUTH_CONTROL_ESCAPE, AUTH_CONTROL_SHOW
 #include "../env_info.h"          // for GetHostName, GetUserName
 #include "../env_settings.h"      // for GetIntSetting, GetStringSetting
 #include "../logging.h"           // for Log, LogErrno
-#include "../mlock_page.h"        // for MLOCK_PAGE
+#include "../secure_arena.h"      // for SecureAlloc, SecureFree
 #include "../util.h"              // for explicit_bzero
-#include "../wait_pgrp.h"         // for WaitPgrp
+#include "../wait_pgrp.h"         // for SpawnHelper, WaitProc
 #include "../wm_properties.h"     // for SetWMProperties
 #include "../xscreensaver_api.h"  // for ReadWindowID
 #include "authproto.h"            // for WritePacket, ReadPacket, PTYPE_R...
@@ -119,6 +122,12 @@ static const char cursor[] = "";
 //! Whether to play sounds during authentication.
 static int auth_sounds = 0;
 
+//! Whether we were started in standby, and thus must wait before showing.
+static int standby = 0;
+
+//! If persistent, the FD to report to main when we hid ourselves; else -1.
+static int persistent_status_fd = -1;
+
 #ifdef HAVE_XKB_EXT
 //! If set, we show Xkb keyboard layout name.
 int show_keyboard_layout = 1;
@@ -135,12 +144,58 @@ size_t num_windows = 0;
 //! The X11 per-monitor windows to draw on.
 Window windows[MAX_WINDOWS];
 
+//! The sizes of the per-monitor windows.
+int window_widths[MAX_WINDOWS], window_heights[MAX_WINDOWS];
+
+//! If set, frames are drawn off-screen and then copied to the window at once.
+int double_buffer = 1;
+
+//! The drawables to draw the frames into; off-screen pixmaps if double_buffer,
+//! or else the windows themselves.
+Drawable drawables[MAX_WINDOWS];
+
 //! The X11 graphics contexts to draw with.
 GC gcs[MAX_WINDOWS];
 
 //! The X11 graphics contexts to draw warnings with.
 GC gcs_warning[MAX_WINDOWS];
 
+//! The X11 graphics contexts to clear and copy the off-screen pixmaps with.
+GC gcs_background[MAX_WINDOWS];
+
+//! If set, the time taken by each frame is measured.
+int debug_frame_time = 0;
+
+//! What the last frame showed on the main per-monitor window, so that only
+//! what changed needs to be redrawn. Never contains the password, only its
+//! mask.
+static struct {
+  //! Whether the window still shows the last frame.
+  int valid;
+  //! The main line of text. Lengths are -1 if too long to remember.
+  char text[256];
+  int text_len;
+  int text_warning;
+  //! The login shown in the bottom left.
+  char login[256];
+  int login_len;
+  //! The right edge of the area the login was drawn in.
+  int login_right;
+  //! The indicators shown in the bottom right.
+  char indicators[128];
+  int indicators_len;
+  int indicators_warning;
+  //! The left edge of the area the indicators were drawn in.
+  int indicators_left;
+} last_frame;
+
+//! The number of frames measured, and their total and maximum time in ms.
+static struct {
+  int count;
+  double total_ms;
+  double max_ms;
+} frame_times;
+
 #ifdef HAVE_XFT_EXT
 //! The Xft draw contexts to draw with.
 XftDraw *xft_draws[MAX_WINDOWS];
@@ -148,6 +203,26 @@ XftDraw *xft_draws[MAX_WINDOWS];
 
 int have_xkb_ext;
 
+#ifdef HAVE_XKB_EXT
+//! The XKB event type, if have_xkb_ext.
+static int xkb_event_base;
+
+//! The cached keyboard description with controls and names, or NULL.
+static XkbDescPtr xkb_desc = NULL;
+
+//! The cached keyboard state; only valid if xkb_state_valid.
+static XkbStateRec xkb_state;
+
+//! The cached indicator state; only valid if xkb_state_valid.
+static unsigned int xkb_indicator_state;
+
+//! Whether xkb_state and xkb_indicator_state are current.
+static int xkb_state_valid = 0;
+
+//! Whether the string returned by GetIndicators() is current.
+static int indicators_valid = 0;
+#endif
+
 enum Sound { SOUND_PROMPT, SOUND_INFO, SOUND_ERROR, SOUND_SUCCESS };
 
 #define NOTE_DS3 156
@@ -208,6 +283,100 @@ void PlaySound(enum Sound snd) {
   nanosleep(&sleeptime, NULL);
 }
 
+#ifdef HAVE_XKB_EXT
+/*! \brief Selects the XKB events that invalidate our cached keyboard state.
+ */
+void SelectXkbEvents(void) {
+  XkbSelectEvents(display, XkbUseCoreKbd,
+                  XkbStateNotifyMask | XkbIndicatorStateNotifyMask |
+                      XkbNamesNotifyMask | XkbControlsNotifyMask |
+                      XkbNewKeyboardNotifyMask,
+                  XkbStateNotifyMask | XkbIndicatorStateNotifyMask |
+                      XkbNamesNotifyMask | XkbControlsNotifyMask |
+                      XkbNewKeyboardNotifyMask);
+  // Only the state shown by GetIndicators() is of interest; without this,
+  // every press of Shift would invalidate it.
+  XkbSelectEventDetails(display, XkbUseCoreKbd, XkbStateNotify,
+                        XkbAllStateComponentsMask,
+                        XkbGroupStateMask | XkbModifierLatchMask |
+                            XkbModifierLockMask);
+}
+
+/*! \brief Handles an XKB event.
+ *
+ * \return Whether the indicators shown need to be updated.
+ */
+int HandleXkbEvent(XEvent *ev) {
+  XkbEvent *xkb_ev = (XkbEvent *)ev;
+  switch (xkb_ev->any.xkb_type) {
+    case XkbStateNotify:
+    case XkbIndicatorStateNotify:
+      xkb_state_valid = 0;
+      break;
+    case XkbNamesNotify:
+    case XkbControlsNotify:
+    case XkbNewKeyboardNotify:
+      if (xkb_desc != NULL) {
+        XkbFreeKeyboard(xkb_desc, 0, True);
+        xkb_desc = NULL;
+      }
+      xkb_state_valid = 0;
+      break;
+    default:
+      return 0;
+  }
+  indicators_valid = 0;
+  return 1;
+}
+
+/*! \brief Makes sure xkb_desc, xkb_state and xkb_indicator_state are current.
+ *
+ * This only needs round trips to the X server if XKB reported a change.
+ *
+ * \return 1 if successful, 0 otherwise.
+ */
+int UpdateXkbCache(void) {
+  if (xkb_desc == NULL) {
+    xkb_desc = XkbGetMap(display, 0, XkbUseCoreKbd);
+    if (xkb_desc == NULL) {
+      Log("XkbGetMap failed");
+      return 0;
+    }
+    if (XkbGetControls(display, XkbGroupsWrapMask, xkb_desc) != Success) {
+      Log("XkbGetControls failed");
+      XkbFreeKeyboard(xkb_desc, 0, True);
+      xkb_desc = NULL;
+      return 0;
+    }
+    if (XkbGetNames(
+            display,
+            XkbIndicatorNamesMask | XkbGroupNamesMask | XkbSymbolsNameMask,
+            xkb_desc) != Success) {
+      Log("XkbGetNames failed");
+      XkbFreeKeyboard(xkb_desc, 0, True);
+      xkb_desc = NULL;
+      return 0;
+    }
+  }
+  if (!xkb_state_valid) {
+    if (XkbGetState(display, XkbUseCoreKbd, &xkb_state) != Success) {
+      Log("XkbGetState failed");
+      return 0;
+    }
+    xkb_indicator_state = 0;
+    if (!show_locks_and_latches) {
+      if (XkbGetIndicatorState(display, XkbUseCoreKbd, &xkb_indicator_state) !=
+          Success) {
+        Log("XkbGetIndicatorState failed");
+        return 0;
+      }
+    }
+    xkb_state_valid = 1;
+  }
+  return 1;
+}
+#endif
+
 /*! \brief Switch to the next keyboard layout.
  */
 void SwitchKeyboardLayout(void) {
@@ -216,27 +385,16 @@ void SwitchKeyboardLayout(void) {
     return;
   }
 
-  XkbDescPtr xkb;
-  xkb = XkbGetMap(display, 0, XkbUseCoreKbd);
-  if (XkbGetControls(display, XkbGroupsWrapMask, xkb) != Success) {
-    Log("XkbGetControls failed");
-    XkbFreeKeyboard(xkb, 0, True);
+  if (!UpdateXkbCache()) {
     return;
   }
-  if (xkb->ctrls->num_groups < 1) {
+  if (xkb_desc->ctrls->num_groups < 1) {
     Log("XkbGetControls returned less than 1 group");
-    XkbFreeKeyboard(xkb, 0, True);
-    return;
-  }
-  XkbStateRec state;
-  if (XkbGetState(display, XkbUseCoreKbd, &state) != Success) {
-    Log("XkbGetState failed");
-    XkbFreeKeyboard(xkb, 0, True);
     return;
   }
 
-  XkbLockGroup(display, XkbUseCoreKbd, (state.group + 1) % xkb->ctrls->num_groups);
-  XkbFreeKeyboard(xkb, 0, True);
+  XkbLockGroup(display, XkbUseCoreKbd,
+               (xkb_state.group + 1) % xkb_desc->ctrls->num_groups);
 #endif
 }
 
@@ -252,41 +410,26 @@ void SwitchKeyboardLayout(void) {
 const char *GetIndicators(int *warning, int *have_multiple_layouts) {
 #ifdef HAVE_XKB_EXT
   static char buf[128];
+  static int cached_warning, cached_have_multiple_layouts;
   char *p;
 
   if (!have_xkb_ext) {
     return "";
   }
 
-  XkbDescPtr xkb;
-  xkb = XkbGetMap(display, 0, XkbUseCoreKbd);
-  if (XkbGetControls(display, XkbGroupsWrapMask, xkb) != Success) {
-    Log("XkbGetControls failed");
-    XkbFreeKeyboard(xkb, 0, True);
-    return "";
+  if (indicators_valid) {
+    *warning |= cached_warning;
+    *have_multiple_layouts |= cached_have_multiple_layouts;
+    return buf;
   }
-  if (XkbGetNames(
-          display,
-          XkbIndicatorNamesMask | XkbGroupNamesMask | XkbSymbolsNameMask,
-          xkb) != Success) {
-    Log("XkbGetNames failed");
-    XkbFreeKeyboard(xkb, 0, True);
-    return "";
-  }
-  XkbStateRec state;
-  if (XkbGetState(display, XkbUseCoreKbd, &state) != Success) {
-    Log("XkbGetState failed");
-    XkbFreeKeyboard(xkb, 0, True);
+
+  if (!UpdateXkbCache()) {
     return "";
   }
-  unsigned int istate = 0;
-  if (!show_locks_and_latches) {
-    if (XkbGetIndicatorState(display, XkbUseCoreKbd, &istate) != Success) {
-      Log("XkbGetIndicatorState failed");
-      XkbFreeKeyboard(xkb, 0, True);
-      return "";
-    }
-  }
+  XkbDescPtr xkb = xkb_desc;
+  const XkbStateRec state = xkb_state;
+  unsigned int istate = xkb_indicator_state;
+  cached_warning = cached_have_multiple_layouts = 0;
 
   // Detect Caps Lock.
   // Note: in very pathological cases the modifier might be set without an
@@ -294,12 +437,12 @@ const char *GetIndicators(int *warning, int *have_multiple_layouts) {
   // why. Such a situation has not been observd yet though.
   unsigned int implicit_mods = state.latched_mods | state.locked_mods;
   if (implicit_mods & LockMask) {
-    *warning = 1;
+    cached_warning = 1;
   }
 
   // Provide info about multiple layouts.
   if (xkb->ctrls->num_groups > 1) {
-    *have_multiple_layouts = 1;
+    cached_have_multiple_layouts = 1;
   }
 
   p = buf;
@@ -308,7 +451,6 @@ const char *GetIndicators(int *warning, int *have_multiple_layouts) {
   size_t n = strlen(word);
   if (n >= sizeof(buf) - (p - buf)) {
     Log("Not enough space to store intro '%s'", word);
-    XkbFreeKeyboard(xkb, 0, True);
     return "";
   }
   memcpy(p, word, n);
@@ -329,7 +471,6 @@ const char *GetIndicators(int *warning, int *have_multiple_layouts) {
       if (n >= sizeof(buf) - (p - buf)) {
         Log("Not enough space to store layout name '%s'", layout);
         XFree(layout);
-        XkbFreeKeyboard(xkb, 0, True);
         return "";
       }
 
@@ -409,7 +550,6 @@ const char *GetIndicators(int *warning, int *have_multiple_layouts) {
 
     if (n >= sizeof(buf) - (p - buf)) {
       Log("Not enough space to store intro '%s'", cpslck);
-      XkbFreeKeyboard(xkb, 0, True);
       return "";
     }
 
@@ -419,8 +559,13 @@ const char *GetIndicators(int *warning, int *have_multiple_layouts) {
   }
 
   *p = 0;
-  XkbFreeKeyboard(xkb, 0, True);
-  return have_output ? buf : "";
+  if (!have_output) {
+    buf[0] = 0;
+  }
+  indicators_valid = 1;
+  *warning |= cached_warning;
+  *have_multiple_layouts |= cached_have_multiple_layouts;
+  return buf;
 #else
   *warning = *warning;                              // Shut up clang-analyzer.
   *have_multiple_layouts = *have_multiple_layouts;  // Shut up clang-analyzer.
@@ -433,6 +578,10 @@ void DestroyPerMonitorWindows(size_t keep_windows) {
 #ifdef HAVE_XFT_EXT
     XftDrawDestroy(xft_draws[i]);
 #endif
+    if (double_buffer) {
+      XFreePixmap(display, drawables[i]);
+    }
+    XFreeGC(display, gcs_background[i]);
     XFreeGC(display, gcs_warning[i]);
     XFreeGC(display, gcs[i]);
     if (i == MAIN_WINDOW) {
@@ -444,6 +593,9 @@ void DestroyPerMonitorWindows(size_t keep_windows) {
   if (num_windows > keep_windows) {
     num_windows = keep_windows;
   }
+  if (keep_windows == 0) {
+    last_frame.valid = 0;
+  }
 }
 
 void CreateOrUpdatePerMonitorWindow(size_t i, const Monitor *monitor, int region_w, int region_h) {
@@ -472,9 +624,30 @@ void CreateOrUpdatePerMonitorWindow(size_t i, const Monitor *monitor, int region
     h = monitor->y + monitor->height - y;
   }
 
+  // X11 does not permit empty windows or pixmaps.
+  if (w < 1) {
+    w = 1;
+  }
+  if (h < 1) {
+    h = 1;
+  }
+
   if (i < num_windows) {
     // Move the existing window.
     XMoveResizeWindow(display, windows[i], x, y, w, h);
+    last_frame.valid = 0;
+    if (double_buffer &&
+        (w != window_widths[i] || h != window_heights[i])) {
+      XFreePixmap(display, drawables[i]);
+      drawables[i] =
+          XCreatePixmap(display, windows[i], w, h,
+                        DefaultDepth(display, DefaultScreen(display)));
+#ifdef HAVE_XFT_EXT
+      XftDrawChange(xft_draws[i], drawables[i]);
+#endif
+    }
+    window_widths[i] = w;
+    window_heights[i] = h;
     return;
   }
 
@@ -527,40 +700,60 @@ void CreateOrUpdatePerMonitorWindow(size_t i, const Monitor *monitor, int region
                              GCFunction | GCForeground | GCBackground |
                                  (core_font != NULL ? GCFont : 0),
                              &gcattrs);
+  gcattrs.foreground = xcolor_background.pixel;
+  // Also used to copy frames, which must not generate NoExpose events.
+  gcattrs.graphics_exposures = False;
+  gcs_background[i] = XCreateGC(
+      display, windows[i],
+      GCFunction | GCForeground | GCBackground | GCGraphicsExposures,
+      &gcattrs);
+  window_widths[i] = w;
+  window_heights[i] = h;
+  if (double_buffer) {
+    // The windows share the depth of the root window; see main.c.
+    drawables[i] = XCreatePixmap(display, windows[i], w, h,
+                                 DefaultDepth(display, DefaultScreen(display)));
+  } else {
+    drawables[i] = windows[i];
+  }
 #ifdef HAVE_XFT_EXT
   xft_draws[i] = XftDrawCreate(
-      display, windows[i], DefaultVisual(display, DefaultScreen(display)),
+      display, drawables[i], DefaultVisual(display, DefaultScreen(display)),
       DefaultColormap(display, DefaultScreen(display)));
 #endif
 
+  // Redraw whenever the window contents got lost.
+  XSelectInput(display, windows[i], ExposureMask);
+  last_frame.valid = 0;
+
   // This window is now ready to use.
   XMapWindow(display, windows[i]);
   num_windows = i + 1;
 }
 
-void UpdatePerMonitorWindows(Monitor* monitor, int region_w, int region_h) {
-  if (monitor == NULL) {
-    DestroyPerMonitorWindows(0);
-    return;
+void HidePerMonitorWindows(void) {
+  for (size_t i = 0; i < num_windows; ++i) {
+    XUnmapWindow(display, windows[i]);
   }
+}
 
-  Window unused_root, unused_child;
-  int unused_root_x, unused_root_y, x, y;
-  unsigned int unused_mask;
-
-  XQueryPointer(display, parent_window, &unused_root, &unused_child,
-                &unused_root_x, &unused_root_y, &x, &y, &unused_mask);
+void ShowPerMonitorWindows(void) {
+  for (size_t i = 0; i < num_windows; ++i) {
+    XMapWindow(display, windows[i]);
+  }
+  last_frame.valid = 0;
+}
 
-  if (x >= monitor->x && x < monitor->x + monitor->width &&
-      y >= monitor->y && y < monitor->y + monitor->height) {
-    CreateOrUpdatePerMonitorWindow(0, monitor, region_w, region_h);
+void UpdatePerMonitorWindows(Monitor* monitor, int region_w, int region_h) {
+  if (monitor == NULL) {
+    DestroyPerMonitorWindows(0);
     return;
   }
 
+  // The auth dialog is only shown on the primary monitor, wherever the
+  // pointer is.
   CreateOrUpdatePerMonitorWindow(0, monitor, region_w, region_h);
   DestroyPerMonitorWindows(1);
-
-  return;
 }
 
 int TextAscent(XftFont *font) {
@@ -600,13 +793,79 @@ int XGlyphInfoExpandAmount(XGlyphInfo *extents) {
   int expand_positive = expand_max > 0 ? expand_max : 0;
   return expand_positive;
 }
+
+//! The number of strings whose text extents are cached.
+#define EXTENTS_CACHE_SIZE 16
+
+//! The maximum length of strings whose text extents are cached.
+#define EXTENTS_CACHE_MAX_LEN 128
+
+//! The text extents of recently drawn strings. As the password itself is
+//! only ever drawn masked, it never ends up in here.
+static struct {
+  XftFont *font;
+  int len;
+  char string[EXTENTS_CACHE_MAX_LEN];
+  XGlyphInfo extents;
+} extents_cache[EXTENTS_CACHE_SIZE];
+
+//! The number of valid entries in extents_cache.
+static size_t extents_cache_used = 0;
+
+//! The entry of extents_cache to replace next.
+static size_t extents_cache_next = 0;
+
+/*! \brief Returns the text extents of a string, like XftTextExtentsUtf8.
+ *
+ * Text drawn repeatedly, such as the prompt and the login, is measured only
+ * once. A run of one ASCII character, such as the password mask, is measured
+ * from a single glyph, so its cost does not grow with the password length.
+ */
+void GetTextExtents(XftFont *font, const char *string, int len,
+                    XGlyphInfo *extents) {
+  int i = 1;
+  while (i < len && string[i] == string[0]) {
+    ++i;
+  }
+  if (len > 1 && i == len && (unsigned char)string[0] < 0x80) {
+    // Xft does not kern, so each further glyph just adds its advance.
+    XGlyphInfo glyph;
+    GetTextExtents(font, string, 1, &glyph);
+    *extents = glyph;
+    extents->width = (len - 1) * glyph.xOff + glyph.width;
+    extents->xOff = len * glyph.xOff;
+    extents->yOff = len * glyph.yOff;
+    return;
+  }
+
+  for (size_t j = 0; j < extents_cache_used; ++j) {
+    if (extents_cache[j].font == font && extents_cache[j].len == len &&
+        memcmp(extents_cache[j].string, string, len) == 0) {
+      *extents = extents_cache[j].extents;
+      return;
+    }
+  }
+  XftTextExtentsUtf8(display, font, (const FcChar8 *)string, len, extents);
+  if (len > EXTENTS_CACHE_MAX_LEN) {
+    return;
+  }
+  size_t j = extents_cache_next;
+  extents_cache_next = (extents_cache_next + 1) % EXTENTS_CACHE_SIZE;
+  if (extents_cache_used <= j) {
+    extents_cache_used = j + 1;
+  }
+  extents_cache[j].font = font;
+  extents_cache[j].len = len;
+  memcpy(extents_cache[j].string, string, len);
+  extents_cache[j].extents = *extents;
+}
 #endif
 
 int TextWidth(XftFont *font, const char *string, int len) {
 #ifdef HAVE_XFT_EXT
   if (font != NULL) {
     XGlyphInfo extents;
-    XftTextExtentsUtf8(display, font, (const FcChar8 *)string, len, &extents);
+    GetTextExtents(font, string, len, &extents);
     return extents.xOff + 2 * XGlyphInfoExpandAmount(&extents);
   }
 #endif
@@ -621,7 +880,7 @@ void DrawString(int monitor, int x, int y, int is_warning, const char *string, i
     // we however do have to work around font descents being drawn to the left
     // of the cursor.
     XGlyphInfo extents;
-    XftTextExtentsUtf8(display, font, (const FcChar8 *)string, len, &extents);
+    GetTextExtents(font, string, len, &extents);
     XftDrawStringUtf8(xft_draws[monitor],
                       is_warning ? &xft_color_warning : &xft_color_foreground,
                       font, x + XGlyphInfoExpandAmount(&extents), y,
@@ -629,7 +888,7 @@ void DrawString(int monitor, int x, int y, int is_warning, const char *string, i
     return;
   }
 #endif
-  XDrawString(display, windows[monitor],
+  XDrawString(display, drawables[monitor],
               is_warning ? gcs_warning[monitor] : gcs[monitor], x, y, string,
               len);
 }
@@ -655,6 +914,90 @@ void BuildLogin(char *output, size_t output_size) {
   *output = 0;
 }
 
+//! Whether main_monitor may be outdated.
+static int monitors_changed = 1;
+
+/*! \brief Handles pending X11 events without blocking.
+ *
+ * Only exposures, monitor, parent window size and keyboard state changes are
+ * of interest; they mark the window contents, main_monitor or the indicators
+ * as outdated, so they get redrawn or queried again on the next render.
+ *
+ * \return Whether a redraw is needed.
+ */
+static int HandleXEvents(void) {
+  int redraw = 0;
+  XEvent ev;
+  while (XPending(display)) {
+    XNextEvent(display, &ev);
+    if (IsMonitorChangeEvent(display, ev.type)) {
+      monitors_changed = 1;
+      redraw = 1;
+    }
+    if (ev.type == ConfigureNotify && ev.xconfigure.window == parent_window) {
+      // main_monitor is clipped to parent_window, which may be resized by our
+      // parent only after we saw the monitor change.
+      monitors_changed = 1;
+      redraw = 1;
+    }
+    if (ev.type == Expose) {
+      last_frame.valid = 0;
+      redraw = 1;
+    }
+#ifdef HAVE_XKB_EXT
+    if (have_xkb_ext && ev.type == xkb_event_base && HandleXkbEvent(&ev)) {
+      redraw = 1;
+    }
+#endif
+  }
+  return redraw;
+}
+
+/*! \brief Clears an area of a per-monitor window to redraw it.
+ */
+void ClearArea(int monitor, int x, int y, int w, int h) {
+  if (double_buffer) {
+    XFillRectangle(display, drawables[monitor], gcs_background[monitor], x, y,
+                   w, h);
+  } else {
+    XClearArea(display, windows[monitor], x, y, w, h, False);
+  }
+}
+
+/*! \brief Shows what was drawn in an area of a per-monitor window.
+ */
+void ShowArea(int monitor, int x, int y, int w, int h) {
+  if (double_buffer) {
+    XCopyArea(display, drawables[monitor], windows[monitor],
+              gcs_background[monitor], x, y, w, h, x, y);
+  }
+}
+
+/*! \brief Remembers a string drawn, so it need not be drawn again.
+ *
+ * \return Whether the string differs from the one remembered before.
+ */
+int RememberString(char *buf, size_t buf_size, int *buf_len,
+                   const char *string, int len) {
+  if (*buf_len == len && memcmp(buf, string, len) == 0) {
+    return 0;
+  }
+  if ((size_t)len < buf_size) {
+    memcpy(buf, string, len);
+    *buf_len = len;
+  } else {
+    *buf_len = -1;
+  }
+  return 1;
+}
+
+//! Returns the current time in milliseconds.
+static double NowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
 /*! \brief Render the conext of the auth module.
  *
  * \param prompt A prompt text.
@@ -662,6 +1005,8 @@ void BuildLogin(char *output, size_t output_size) {
  * \param is_warning Whether to use the warning style.
  */
 void RenderContext(const char *prompt, const char *message, int is_warning) {
+  double start_ms = debug_frame_time ? NowMs() : 0;
+
   int len_prompt = strlen(prompt);
   int tw_prompt = TextWidth(xft_font_large, prompt, len_prompt);
 
@@ -672,19 +1017,50 @@ void RenderContext(const char *prompt, const char *message, int is_warning) {
   BuildLogin(login, sizeof(login));
   int len_login = strlen(login);
 
+  // Process pending notifications first, so the cached keyboard state and
+  // monitor layout used below are current.
+  HandleXEvents();
+
   int indicators_warning = 0;
   int have_multiple_layouts = 0;
   const char *indicators = GetIndicators(&indicators_warning, &have_multiple_layouts);
   int len_indicators = strlen(indicators);
   int tw_indicators = TextWidth(xft_font, indicators, len_indicators);
 
-  GetPrimaryMonitor(display, parent_window, &main_monitor);
+  // Only query the monitor layout when it changed, so redrawing for a
+  // keystroke does not need any round trips.
+  int layout_changed = monitors_changed;
+  if (monitors_changed) {
+    GetPrimaryMonitor(display, parent_window, &main_monitor);
+    monitors_changed = 0;
+  }
   double scale = main_monitor.ppi/100;
 
   int region_w = main_monitor.width;
   int region_h = main_monitor.height * 0.55 * scale;
 
-  UpdatePerMonitorWindows(&main_monitor, region_w, region_h);
+  if (layout_changed || num_windows == 0) {
+    UpdatePerMonitorWindows(&main_monitor, region_w, region_h);
+  }
+
+  // Work out which parts changed since the last frame.
+  int full = !last_frame.valid;
+  const char *text = len_message > 0 ? message : prompt;
+  int len_text = len_message > 0 ? len_message : len_prompt;
+  int tw_text = len_message > 0 ? tw_message : tw_prompt;
+  int text_dirty = RememberString(last_frame.text, sizeof(last_frame.text),
+                                  &last_frame.text_len, text, len_text) ||
+                   is_warning != last_frame.text_warning || full;
+  int login_dirty = RememberString(last_frame.login, sizeof(last_frame.login),
+                                   &last_frame.login_len, login, len_login) ||
+                    full;
+  int indicators_dirty =
+      RememberString(last_frame.indicators, sizeof(last_frame.indicators),
+                     &last_frame.indicators_len, indicators, len_indicators) ||
+      indicators_warning != last_frame.indicators_warning || full;
+  last_frame.text_warning = is_warning;
+  last_frame.indicators_warning = indicators_warning;
+  last_frame.valid = 1;
 
   int x = region_w / 2;
 
@@ -692,20 +1068,84 @@ void RenderContext(const char *prompt, const char *message, int is_warning) {
   int descent = TextDescent(xft_font_large);
   int y = (ascent + descent + 30) * scale;
 
-  XClearWindow(display, windows[0]);
+  if (full) {
+    ClearArea(0, 0, 0, window_widths[0], window_heights[0]);
+  }
 
-  if (strlen(message) > 0) {
-    DrawString(0, x - tw_message / 2, y, is_warning, message, len_message, xft_font_large);
-  } else {
-    DrawString(0, x - tw_prompt / 2, y, is_warning, prompt, len_prompt, xft_font_large);
+  // The main line spans the whole width, as its text is centered.
+  if (text_dirty) {
+    int top = y - ascent;
+    if (!full) {
+      ClearArea(0, 0, top, region_w, ascent + descent);
+    }
+    DrawString(0, x - tw_text / 2, y, is_warning, text, len_text,
+               xft_font_large);
+    if (!full) {
+      ShowArea(0, 0, top, region_w, ascent + descent);
+    }
   }
 
-  x = 5;
+  // The login and indicators only need their own area on the bottom line,
+  // extended by the descent to cover glyphs reaching beyond their advance.
+  int small_ascent = TextAscent(xft_font);
+  int small_descent = TextDescent(xft_font);
   y = region_h - 5;
-  DrawString(0, x, y, 0, login, len_login, xft_font);
+  int top = y - small_ascent;
+  int height = small_ascent + small_descent;
+  int login_right = 5 + TextWidth(xft_font, login, len_login) + small_descent;
+  int indicators_left = region_w - tw_indicators - 5 - small_descent;
+  int login_area = login_right > last_frame.login_right
+                       ? login_right
+                       : last_frame.login_right;
+  int indicators_area = indicators_left < last_frame.indicators_left
+                            ? indicators_left
+                            : last_frame.indicators_left;
+  if ((login_dirty || indicators_dirty) && login_area > indicators_area) {
+    // They overlap, so clearing one would damage the other; redraw both.
+    login_dirty = indicators_dirty = 1;
+    login_area = indicators_area = region_w;
+  }
+  last_frame.login_right = login_right;
+  last_frame.indicators_left = indicators_left;
+  if (!full) {
+    if (login_dirty) {
+      ClearArea(0, 0, top, login_area, height);
+    }
+    if (indicators_dirty && indicators_area < region_w) {
+      ClearArea(0, indicators_area, top, region_w - indicators_area, height);
+    }
+  }
+  if (login_dirty) {
+    DrawString(0, 5, y, 0, login, len_login, xft_font);
+  }
+  if (indicators_dirty) {
+    DrawString(0, region_w - tw_indicators - 5, y, indicators_warning,
+               indicators, len_indicators, xft_font);
+  }
+  if (!full) {
+    if (login_dirty) {
+      ShowArea(0, 0, top, login_area, height);
+    }
+    if (indicators_dirty && indicators_area < region_w) {
+      ShowArea(0, indicators_area, top, region_w - indicators_area, height);
+    }
+  }
+
+  if (full) {
+    ShowArea(0, 0, 0, window_widths[0], window_heights[0]);
+  }
 
-  x = region_w - tw_indicators - 5;
-  DrawString(0, x, y, indicators_warning, indicators, len_indicators, xft_font);
+  if (debug_frame_time) {
+    // Include the time the X server needs to draw the frame.
+    XSync(display, False);
+    double frame_ms = NowMs() - start_ms;
+    ++frame_times.count;
+    frame_times.total_ms += frame_ms;
+    if (frame_ms > frame_times.max_ms) {
+      frame_times.max_ms = frame_ms;
+    }
+    return;
+  }
 
   // Make the things just drawn appear on the screen as soon as possible.
   XFlush(display);
@@ -733,7 +1173,7 @@ void WaitForKeypress(int seconds) {
  *
  * \param msg The message.
  * \param response The response will be stored in a newly allocated buffer here.
- *   The caller is supposed to eventually free() it.
+ *   The caller is supposed to eventually SecureFree() it.
  * \param echo If true, the input will be shown; otherwise it will be hidden
  *   (password entry).
  * \return 1 if successful, anything else otherwise.
@@ -761,22 +1201,31 @@ int Prompt(char *msg, char **response, int echo) {
     // The time of last keystroke.
     struct timeval last_keystroke;
 
+    // The number of bytes of the input that have been counted as whole
+    // characters, and the number of these characters. Kept across frames, so
+    // typing does not need to walk the whole input again.
+    size_t countedpos;
+    size_t countedchars;
+
     // Temporary position variables that might leak properties about the
     // password and thus are in the private struct too.
     size_t prevpos;
     size_t pos;
     int len;
-  } priv;
+  } *priv = SecureAlloc(sizeof(*priv));
+  if (priv == NULL) {
+    return 0;
+  }
 
-  if (!echo && MLOCK_PAGE(&priv, sizeof(priv)) < 0) {
-    LogErrno("mlock");
+  if (!echo && GetSecureArenaLockedBytes() == 0) {
     // We continue anyway, as the user being unable to unlock the screen is
     // worse. But let's alert the user.
     RenderContext("", "Password will not be stored securely.", 1);
     WaitForKeypress(1);
   }
 
-  priv.pwlen = 0;
+  priv->pwlen = 0;
+  priv->countedpos = priv->countedchars = 0;
 
   time_t deadline = time(NULL) + prompt_timeout;
 
@@ -789,40 +1238,45 @@ int Prompt(char *msg, char **response, int echo) {
 
   while (!done) {
     if (echo) {
-      if (priv.pwlen != 0) {
-        memcpy(priv.displaybuf, priv.pwbuf, priv.pwlen);
+      if (priv->pwlen != 0) {
+        memcpy(priv->displaybuf, priv->pwbuf, priv->pwlen);
       }
-      priv.displaylen = priv.pwlen;
-      // Note that priv.pwlen <= sizeof(priv.pwbuf) and thus
-      // priv.pwlen + 2 <= sizeof(priv.displaybuf).
-      priv.displaybuf[priv.displaylen] = *cursor;
-      priv.displaybuf[priv.displaylen + 1] = '\0';
+      priv->displaylen = priv->pwlen;
+      // Note that priv->pwlen <= sizeof(priv->pwbuf) and thus
+      // priv->pwlen + 2 <= sizeof(priv->displaybuf).
+      priv->displaybuf[priv->displaylen] = *cursor;
+      priv->displaybuf[priv->displaylen + 1] = '\0';
     } else {
       if (strcmp(password_prompt, "hidden") == 0) {
-        priv.displaylen = 0;
-        priv.displaybuf[0] = '\0';
+        priv->displaylen = 0;
+        priv->displaybuf[0] = '\0';
       } else {
+        // Only count what was typed since the last frame; anything that
+        // shortens the input resets the count.
         mblen(NULL, 0);
-        priv.pos = priv.displaylen = 0;
-        while (priv.pos < priv.pwlen) {
-          ++priv.displaylen;
-          // Note: this won't read past priv.pwlen.
-          priv.len = mblen(priv.pwbuf + priv.pos, priv.pwlen - priv.pos);
-          if (priv.len <= 0) {
-            // This guarantees to "eat" one byte each step. Therefore,
-            // priv.displaylen <= priv.pwlen is ensured.
+        while (priv->countedpos < priv->pwlen) {
+          // Note: this won't read past priv->pwlen.
+          priv->len = mblen(priv->pwbuf + priv->countedpos,
+                            priv->pwlen - priv->countedpos);
+          if (priv->len <= 0) {
+            // Incomplete or invalid; retried once more input arrives.
             break;
           }
-          priv.pos += priv.len;
+          priv->countedpos += priv->len;
+          ++priv->countedchars;
         }
-        memset(priv.displaybuf, '*', priv.displaylen);
-        // Note that priv.pwlen <= sizeof(priv.pwbuf) and thus
-        // priv.pwlen + 2 <= sizeof(priv.displaybuf).
-        priv.displaybuf[priv.displaylen] = *cursor;
-        priv.displaybuf[priv.displaylen + 1] = '\0';
+        // The rest counts as a single character. Therefore,
+        // priv->displaylen <= priv->pwlen is ensured.
+        priv->displaylen =
+            priv->countedchars + (priv->countedpos < priv->pwlen ? 1 : 0);
+        memset(priv->displaybuf, '*', priv->displaylen);
+        // Note that priv->pwlen <= sizeof(priv->pwbuf) and thus
+        // priv->pwlen + 2 <= sizeof(priv->displaybuf).
+        priv->displaybuf[priv->displaylen] = *cursor;
+        priv->displaybuf[priv->displaylen + 1] = '\0';
       }
     }
-    RenderContext(msg, priv.displaybuf, 0);
+    RenderContext(msg, priv->displaybuf, 0);
 
     if (!played_sound) {
       PlaySound(SOUND_PROMPT);
@@ -834,11 +1288,19 @@ int Prompt(char *msg, char **response, int echo) {
     timeout.tv_usec = (250 * 1000) % 1000000;
 
     while (!done) {
+      // Events already read into the Xlib queue don't make x11_fd readable.
+      if (XQLength(display) > 0 && HandleXEvents()) {
+        // Redraw for the new monitor layout or keyboard state.
+        break;
+      }
+      // Also wake up for X11 events, so e.g. Caps Lock is shown promptly.
+      int x11_fd = ConnectionNumber(display);
       fd_set set;
       memset(&set, 0, sizeof(set));  // For clang-analyzer.
       FD_ZERO(&set);
       FD_SET(0, &set);
-      int nfds = select(1, &set, NULL, NULL, &timeout);
+      FD_SET(x11_fd, &set);
+      int nfds = select(x11_fd + 1, &set, NULL, NULL, &timeout);
       if (nfds < 0) {
         LogErrno("select");
         done = 1;
@@ -858,6 +1320,13 @@ int Prompt(char *msg, char **response, int echo) {
         // Blink...
         break;
       }
+      if (!FD_ISSET(0, &set)) {
+        if (HandleXEvents()) {
+          // Redraw for the new monitor layout or keyboard state.
+          break;
+        }
+        continue;
+      }
 
       // From now on, only do nonblocking selects so we update the screen ASAP.
       timeout.tv_usec = 0;
@@ -865,37 +1334,39 @@ int Prompt(char *msg, char **response, int echo) {
       // Reset the prompt timeout.
       deadline = now + prompt_timeout;
 
-      ssize_t nread = read(0, &priv.inputbuf, 1);
+      ssize_t nread = read(0, &priv->inputbuf, 1);
       if (nread <= 0) {
         Log("EOF on password input - bailing out");
         done = 1;
         break;
       }
-      switch (priv.inputbuf) {
+      switch (priv->inputbuf) {
         case '\b':      // Backspace.
         case '\177': {  // Delete (note: i3lock does not handle this one).
           // Backwards skip with multibyte support.
           mblen(NULL, 0);
-          priv.pos = priv.prevpos = 0;
-          while (priv.pos < priv.pwlen) {
-            priv.prevpos = priv.pos;
-            // Note: this won't read past priv.pwlen.
-            priv.len = mblen(priv.pwbuf + priv.pos, priv.pwlen - priv.pos);
-            if (priv.len <= 0) {
+          priv->pos = priv->prevpos = 0;
+          while (priv->pos < priv->pwlen) {
+            priv->prevpos = priv->pos;
+            // Note: this won't read past priv->pwlen.
+            priv->len = mblen(priv->pwbuf + priv->pos, priv->pwlen - priv->pos);
+            if (priv->len <= 0) {
               // This guarantees to "eat" one byte each step. Therefore,
               // this cannot loop endlessly.
               break;
             }
-            priv.pos += priv.len;
+            priv->pos += priv->len;
           }
-          priv.pwlen = priv.prevpos;
+          priv->pwlen = priv->prevpos;
+          priv->countedpos = priv->countedchars = 0;
           break;
         }
         case '\001':  // Ctrl-A.
           // Clearing input line on just Ctrl-A is odd - but commonly
           // requested. In most toolkits, Ctrl-A does not immediately erase but
           // almost every keypress other than arrow keys will erase afterwards.
-          priv.pwlen = 0;
+          priv->pwlen = 0;
+          priv->countedpos = priv->countedchars = 0;
           break;
         case '\023':  // Ctrl-S.
           SwitchKeyboardLayout();
@@ -904,39 +1375,44 @@ int Prompt(char *msg, char **response, int echo) {
           // Delete the entire input line.
           // i3lock: supports Ctrl-U but not Ctrl-A.
           // xscreensaver: supports Ctrl-U and Ctrl-X but not Ctrl-A.
-          priv.pwlen = 0;
+          priv->pwlen = 0;
+          priv->countedpos = priv->countedchars = 0;
+          break;
+        case AUTH_CONTROL_ESCAPE: {  // Control command from main.
+          // The only one is AUTH_CONTROL_SHOW, and we are shown already.
+          char command;
+          if (read(0, &command, 1) == 1 && command != AUTH_CONTROL_SHOW) {
+            Log("Ignoring unknown control command %d", command);
+          }
           break;
-        case 0:       // Shouldn't happen.
+        }
         case '\033':  // Escape.
           done = 1;
           break;
         case '\r':  // Return.
         case '\n':  // Return.
-          *response = malloc(priv.pwlen + 1);
-          if (!echo && MLOCK_PAGE(*response, priv.pwlen + 1) < 0) {
-            LogErrno("mlock");
-            // We continue anyway, as the user being unable to unlock the screen
-            // is worse. But let's alert the user of this.
-            RenderContext("", "Password has not been stored securely.", 1);
-            WaitForKeypress(1);
+          *response = SecureAlloc(priv->pwlen + 1);
+          if (*response == NULL) {
+            done = 1;
+            break;
           }
-          if (priv.pwlen != 0) {
-            memcpy(*response, priv.pwbuf, priv.pwlen);
+          if (priv->pwlen != 0) {
+            memcpy(*response, priv->pwbuf, priv->pwlen);
           }
-          (*response)[priv.pwlen] = 0;
+          (*response)[priv->pwlen] = 0;
           status = 1;
           done = 1;
           break;
         default:
-          if (priv.inputbuf >= '\000' && priv.inputbuf <= '\037') {
+          if (priv->inputbuf >= '\000' && priv->inputbuf <= '\037') {
             // Other control character. We ignore them (and specifically do not
             // update the cursor on them) to "discourage" their use in
             // passwords, as most login screens do not support them anyway.
             break;
           }
-          if (priv.pwlen < sizeof(priv.pwbuf)) {
-            priv.pwbuf[priv.pwlen] = priv.inputbuf;
-            ++priv.pwlen;
+          if (priv->pwlen < sizeof(priv->pwbuf)) {
+            priv->pwbuf[priv->pwlen] = priv->inputbuf;
+            ++priv->pwlen;
           } else {
             Log("Password entered is too long - bailing out");
             done = 1;
@@ -948,7 +1424,7 @@ int Prompt(char *msg, char **response, int echo) {
   }
 
   // priv contains password related data, so better clear it.
-  memset(&priv, 0, sizeof(priv));
+  SecureFree(priv);
 
   if (!done) {
     Log("Unreachable code - the loop above must set done");
@@ -956,111 +1432,148 @@ int Prompt(char *msg, char **response, int echo) {
   return status;
 }
 
-/*! \brief Perform authentication using a helper proxy.
+/*! \brief Waits for main to tell us to show the auth dialog.
  *
- * \return The authentication status (0 for OK, 1 otherwise).
+ * Used when in standby. Any other input is discarded; main does not send key
+ * presses while the auth dialog is hidden, and anything typed after an
+ * authentication attempt ended must not go into the next one.
+ *
+ * \return 1 if the dialog is to be shown, 0 on EOF or error.
  */
-int Authenticate() {
+int WaitForShowCommand(void) {
+  int after_escape = 0;
+  for (;;) {
+    char c;
+    ssize_t nread = read(0, &c, 1);
+    if (nread < 0 && errno == EINTR) {
+      continue;
+    }
+    if (nread <= 0) {
+      return 0;
+    }
+    if (after_escape && c == AUTH_CONTROL_SHOW) {
+      return 1;
+    }
+    after_escape = !after_escape && (c == AUTH_CONTROL_ESCAPE);
+  }
+}
+
+/*! \brief Tells main that we hid ourselves after an authentication attempt.
+ */
+void ReportHidden(void) {
+  char c = AUTH_CONTROL_HIDE;
+  while (write(persistent_status_fd, &c, 1) != 1) {
+    if (errno != EINTR) {
+      LogErrno("write");
+      return;
+    }
+  }
+}
+
+//! Makes fd close-on-exec, so it is not inherited by any child process.
+static void SetCloexec(int fd) {
+  int flags = fcntl(fd, F_GETFD);
+  if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+    LogErrno("fcntl(FD_CLOEXEC)");
+  }
+}
+
+//! The authproto helper started by StartAuthproto().
+static struct {
+  //! Its PID, or 0 if not running.
+  pid_t pid;
+  //! Our end of the pipe it writes requests to.
+  int requestfd;
+  //! Our end of the pipe it reads responses from.
+  int responsefd;
+} authproto = {0, -1, -1};
+
+/*! \brief Starts the authproto helper, unless it is running already.
+ *
+ * The helper sets up PAM right away and then blocks on its first prompt until
+ * Authenticate() reads it, so this can be called early to do the PAM setup in
+ * parallel with ours.
+ *
+ * \return Zero if the helper is running.
+ */
+static int StartAuthproto(void) {
+  if (authproto.pid != 0) {
+    return 0;
+  }
   int requestfd[2], responsefd[2];
   if (pipe(requestfd)) {
     LogErrno("pipe");
-    return 1;
+    return -1;
   }
   if (pipe(responsefd)) {
     LogErrno("pipe");
-    return 1;
+    close(requestfd[0]);
+    close(requestfd[1]);
+    return -1;
   }
 
-  // Use authproto_pam.
-  pid_t childpid = ForkWithoutSigHandlers();
-  if (childpid == -1) {
-    LogErrno("fork");
-    return 1;
-  }
+  // Our ends of the pipes must not be inherited by authproto_pam.
+  SetCloexec(requestfd[0]);
+  SetCloexec(responsefd[1]);
 
-  if (childpid == 0) {
-    // Child process. Just run authproto_pam.
-    // But first, move requestfd[1] to 1 and responsefd[0] to 0.
+  // Use authproto_pam, with requestfd[1] as stdout and responsefd[0] as stdin.
+  const char *args[2] = {authproto_executable, NULL};
+  SpawnOptions options = {responsefd[0], requestfd[1], /*new_pgrp=*/0, NULL,
+                         NULL};
+  pid_t childpid = SpawnHelper(authproto_executable, args, &options);
+  close(requestfd[1]);
+  close(responsefd[0]);
+  if (childpid == -1) {
     close(requestfd[0]);
     close(responsefd[1]);
-
-    if (requestfd[1] == 0) {
-      // Tricky case. We don't _expect_ this to happen - after all,
-      // initially our own fd 0 should be bound to xsecurelock's main
-      // program - but nevertheless let's handle it.
-      // At least this implies that no other fd is 0.
-      int requestfd1 = dup(requestfd[1]);
-      if (requestfd1 == -1) {
-        LogErrno("dup");
-        _exit(EXIT_FAILURE);
-      }
-      close(requestfd[1]);
-      if (dup2(responsefd[0], 0) == -1) {
-        LogErrno("dup2");
-        _exit(EXIT_FAILURE);
-      }
-      close(responsefd[0]);
-      if (requestfd1 != 1) {
-        if (dup2(requestfd1, 1) == -1) {
-          LogErrno("dup2");
-          _exit(EXIT_FAILURE);
-        }
-        close(requestfd1);
-      }
-    } else {
-      if (responsefd[0] != 0) {
-        if (dup2(responsefd[0], 0) == -1) {
-          LogErrno("dup2");
-          _exit(EXIT_FAILURE);
-        }
-        close(responsefd[0]);
-      }
-      if (requestfd[1] != 1) {
-        if (dup2(requestfd[1], 1) == -1) {
-          LogErrno("dup2");
-          _exit(EXIT_FAILURE);
-        }
-        close(requestfd[1]);
-      }
-    }
-    {
-      const char *args[2] = {authproto_executable, NULL};
-      ExecvHelper(authproto_executable, args);
-      sleep(2);  // Reduce log spam or other effects from failed execv.
-      _exit(EXIT_FAILURE);
-    }
+    return -1;
   }
+  authproto.pid = childpid;
+  authproto.requestfd = requestfd[0];
+  authproto.responsefd = responsefd[1];
+  return 0;
+}
 
-  // Otherwise, we're in the parent process.
-  close(requestfd[1]);
-  close(responsefd[0]);
+/*! \brief Perform authentication using a helper proxy.
+ *
+ * Uses the helper started by StartAuthproto(), or starts one.
+ *
+ * \return The authentication status (0 for OK, 1 otherwise).
+ */
+int Authenticate() {
+  if (StartAuthproto()) {
+    return 1;
+  }
+  pid_t childpid = authproto.pid;
+  int requestfd = authproto.requestfd;
+  int responsefd = authproto.responsefd;
+  authproto.pid = 0;
   for (;;) {
     char *message;
     char *response;
-    char type = ReadPacket(requestfd[0], &message, 1);
+    char type = ReadPacket(requestfd, &message, 1);
     switch (type) {
       case PTYPE_INFO_MESSAGE:
         RenderContext("", message, 0);
-        explicit_bzero(message, strlen(message));
-        free(message);
         PlaySound(SOUND_INFO);
         WaitForKeypress(1);
+        explicit_bzero(message, strlen(message));
+        free(message);
         break;
       case PTYPE_ERROR_MESSAGE:
         RenderContext("", message, 1);
-        explicit_bzero(message, strlen(message));
-        free(message);
         PlaySound(SOUND_ERROR);
         WaitForKeypress(1);
+        explicit_bzero(message, strlen(message));
+        free(message);
         break;
       case PTYPE_PROMPT_LIKE_PASSWORD:
         if (Prompt(message, &response, 0)) {
           RenderContext("Processing...", "", 0);
-          WritePacket(responsefd[1], PTYPE_RESPONSE_LIKE_PASSWORD, response);
-          explicit_bzero(response, strlen(response));
-          free(response);
+          WritePacket(responsefd, PTYPE_RESPONSE_LIKE_PASSWORD, response);
+          SecureFree(response);
         } else {
-          WritePacket(responsefd[1], PTYPE_RESPONSE_CANCELLED, "");
+          WritePacket(responsefd, PTYPE_RESPONSE_CANCELLED, "");
         }
         explicit_bzero(message, strlen(message));
         free(message);
@@ -1075,8 +1588,9 @@ int Authenticate() {
     }
   }
 done:
-  close(requestfd[0]);
-  close(responsefd[1]);
+  DiscardPacketBuffer(requestfd);
+  close(requestfd);
+  close(responsefd);
   int status;
   if (!WaitProc("authproto", &childpid, 1, 0, &status)) {
     Log("WaitPgrp returned false but we were blocking");
@@ -1131,6 +1645,34 @@ int main(int argc_local, char **argv_local) {
   prompt_timeout = GetIntSetting("XSECURELOCK_AUTH_TIMEOUT", 30);
   password_prompt = GetStringSetting("XSECURELOCK_PASSWORD_PROMPT", "asterisks");
   auth_sounds = GetIntSetting("XSECURELOCK_AUTH_SOUNDS", 1);
+  double_buffer = GetIntSetting("XSECURELOCK_AUTH_DOUBLE_BUFFER", 1);
+  debug_frame_time = GetIntSetting("XSECURELOCK_DEBUG_FRAME_TIME", 0);
+  standby = GetIntSetting(AUTH_CONTROL_STANDBY_ENV, 0);
+  persistent_status_fd = GetIntSetting(AUTH_CONTROL_PERSISTENT_ENV, -1);
+  // Not for our children.
+  unsetenv(AUTH_CONTROL_STANDBY_ENV);
+  unsetenv(AUTH_CONTROL_PERSISTENT_ENV);
+  if (persistent_status_fd >= 0) {
+    int flags = fcntl(persistent_status_fd, F_GETFD);
+    if (flags == -1 ||
+        fcntl(persistent_status_fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+      LogErrno("Invalid status FD %d", persistent_status_fd);
+      return 1;
+    }
+    // A persistent auth child always waits to be shown.
+    standby = 1;
+  }
+
+  // Failure is shown to the user by Prompt().
+  InitSecureArena(SECURE_ARENA_SIZE);
+
+  // Let PAM load its modules while we load fonts and create windows. In
+  // standby, this is done once we are shown instead, so no PAM conversation
+  // sits idle for long.
+  InitWaitPgrp();
+  if (!standby) {
+    StartAuthproto();
+  }
 
   if ((display = XOpenDisplay(NULL)) == NULL) {
     Log("Could not connect to $DISPLAY");
@@ -1138,11 +1680,14 @@ int main(int argc_local, char **argv_local) {
   }
 
 #ifdef HAVE_XKB_EXT
-  int xkb_opcode, xkb_event_base, xkb_error_base;
+  int xkb_opcode, xkb_error_base;
   int xkb_major_version = XkbMajorVersion, xkb_minor_version = XkbMinorVersion;
   have_xkb_ext =
       XkbQueryExtension(display, &xkb_opcode, &xkb_event_base, &xkb_error_base,
                         &xkb_major_version, &xkb_minor_version);
+  if (have_xkb_ext) {
+    SelectXkbEvents();
+  }
 #endif
 
   if (!GetHostName(hostname, sizeof(hostname))) {
@@ -1185,7 +1730,11 @@ int main(int argc_local, char **argv_local) {
   xft_font_large = NULL;
 #endif
 
+  // Select the events first, so no change after the query is missed.
+  SelectMonitorChangeEvents(display, main_window);
+  XSelectInput(display, parent_window, StructureNotifyMask);
   GetPrimaryMonitor(display, parent_window, &main_monitor);
+  monitors_changed = 0;
   double scale = main_monitor.ppi/100;
   double font_size = 12 * scale;
   double font_large_size = 20 * scale;
@@ -1249,13 +1798,41 @@ int main(int argc_local, char **argv_local) {
   }
 #endif
 
-  SelectMonitorChangeEvents(display, main_window);
-  InitWaitPgrp();
-  int status = Authenticate();
+  int status;
+  for (;;) {
+    // All set up - now, if in standby, wait until we are actually needed.
+    if (standby) {
+      XFlush(display);
+      if (!WaitForShowCommand()) {
+        status = 1;
+        break;
+      }
+      StartAuthproto();
+      ShowPerMonitorWindows();
+    }
+
+    status = Authenticate();
+    if (status == 0 || persistent_status_fd < 0) {
+      break;
+    }
+
+    // Failed, but persistent: keep everything around and try again once
+    // main tells us to.
+    HidePerMonitorWindows();
+    XFlush(display);
+    ReportHidden();
+    standby = 1;
+  }
 
   // Clear any possible processing message by closing our windows.
   DestroyPerMonitorWindows(0);
 
+  if (debug_frame_time && frame_times.count > 0) {
+    Log("Frame times (double buffering %s): n=%d avg=%.2f ms max=%.2f ms",
+        double_buffer ? "on" : "off", frame_times.count,
+        frame_times.total_ms / frame_times.count, frame_times.max_ms);
+  }
+
 #ifdef HAVE_XFT_EXT
   if (xft_font != NULL) {
     XftColorFree(display, DefaultVisual(display, DefaultScreen(display)),
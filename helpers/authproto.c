@@ -16,32 +16,57 @@ limitations under the License.
 
 #include "authproto.h"
 
-#include <errno.h>   // for errno
-#include <stdio.h>   // for snprintf
-#include <stdlib.h>  // for malloc, size_t
-#include <string.h>  // for strlen
-#include <unistd.h>  // for read, write, ssize_t
+#include <errno.h>    // for errno
+#include <stdio.h>    // for snprintf
+#include <stdlib.h>   // for malloc, size_t
+#include <string.h>   // for memcpy, strlen
+#include <sys/uio.h>  // for writev, iovec
+#include <unistd.h>   // for read, ssize_t
 
-#include "../logging.h"     // for LogErrno, Log
-#include "../mlock_page.h"  // for MLOCK_PAGE
-#include "../util.h"        // for explicit_bzero
+#include "../logging.h"       // for LogErrno, Log
+#include "../mlock_page.h"    // for MLOCK_PAGE
+#include "../secure_arena.h"  // for SecureAlloc
+#include "../util.h"          // for explicit_bzero
 
-static size_t WriteChars(int fd, const char *buf, size_t n) {
+//! The size of the read buffer; large enough for most packets.
+#define READ_BUFFER_SIZE 1024
+
+//! Data read ahead by ReadPacket(). As it may contain passwords, it lives in
+//! the secure arena and consumed bytes are wiped right away.
+static struct {
+  //! The file descriptor the buffered data came from, or -1.
+  int fd;
+  //! The buffer, allocated on first use.
+  char *buf;
+  //! The first buffered byte not consumed yet.
+  size_t start;
+  //! The end of the buffered data.
+  size_t end;
+} reader = {-1, NULL, 0, 0};
+
+static size_t WriteIov(int fd, struct iovec *iov, int iovcnt) {
   size_t total = 0;
-  while (total < n) {
-    ssize_t got = write(fd, buf + total, n - total);
+  while (iovcnt > 0) {
+    ssize_t got = writev(fd, iov, iovcnt);
     if (got < 0) {
-      LogErrno("write");
+      LogErrno("writev");
       return 0;
     }
     if (got == 0) {
-      Log("write: could not write anything, send buffer full");
+      Log("writev: could not write anything, send buffer full");
       return 0;
     }
-    if ((size_t)got > n - total) {
-      Log("write: overlong write (should never happen)");
-    }
     total += got;
+    // Skip what has been written; only happens for messages beyond PIPE_BUF.
+    while (iovcnt > 0 && (size_t)got >= iov->iov_len) {
+      got -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + got;
+      iov->iov_len -= got;
+    }
   }
   return total;
 }
@@ -63,25 +88,80 @@ void WritePacket(int fd, char type, const char *message) {
     Log("overlong prefix, cannot write");
     return;
   }
-  // Yes, we're wasting syscalls here. This doesn't need to be fast though, and
-  // this way we can avoid an extra buffer.
-  if (!WriteChars(fd, prefix, prefixlen)) {
+  // Write the whole packet at once, without copying the message to yet
+  // another buffer. Up to PIPE_BUF bytes, this also makes the write atomic.
+  struct iovec iov[3];
+  iov[0].iov_base = prefix;
+  iov[0].iov_len = prefixlen;
+  iov[1].iov_base = (char *)message;
+  iov[1].iov_len = len;
+  iov[2].iov_base = "\n";
+  iov[2].iov_len = 1;
+  WriteIov(fd, iov, 3);
+}
+
+void DiscardPacketBuffer(int fd) {
+  if (reader.fd != fd) {
     return;
   }
-  if (len != 0 && !WriteChars(fd, message, len)) {
-    return;
+  if (reader.buf != NULL) {
+    explicit_bzero(reader.buf + reader.start, reader.end - reader.start);
   }
-  if (!WriteChars(fd, "\n", 1)) {
-    return;
+  reader.fd = -1;
+  reader.start = reader.end = 0;
+}
+
+/*! \brief Reads more data into the (empty) read buffer.
+ *
+ * \return The number of bytes read, 0 at end of file, or -1 on error.
+ */
+static ssize_t FillReadBuffer(int fd) {
+  if (reader.buf == NULL) {
+    reader.buf = SecureAlloc(READ_BUFFER_SIZE);
+    if (reader.buf == NULL) {
+      return -1;
+    }
+  }
+  if (reader.fd != fd) {
+    DiscardPacketBuffer(reader.fd);
+    reader.fd = fd;
+  }
+  reader.start = reader.end = 0;
+  ssize_t got = read(fd, reader.buf, READ_BUFFER_SIZE);
+  if (got < 0) {
+    LogErrno("read");
+    return -1;
   }
+  reader.end = got;
+  return got;
 }
 
 static size_t ReadChars(int fd, char *buf, size_t n, int eof_permitted) {
   size_t total = 0;
   while (total < n) {
-    ssize_t got = read(fd, buf + total, n - total);
+    if (reader.fd == fd && reader.start < reader.end) {
+      size_t chunk = reader.end - reader.start;
+      if (chunk > n - total) {
+        chunk = n - total;
+      }
+      memcpy(buf + total, reader.buf + reader.start, chunk);
+      explicit_bzero(reader.buf + reader.start, chunk);
+      reader.start += chunk;
+      total += chunk;
+      continue;
+    }
+    // Large messages are better read in place than copied.
+    int direct = n - total >= READ_BUFFER_SIZE / 2;
+    ssize_t got;
+    if (direct) {
+      got = read(fd, buf + total, n - total);
+      if (got < 0) {
+        LogErrno("read");
+      }
+    } else {
+      got = FillReadBuffer(fd);
+    }
     if (got < 0) {
-      LogErrno("read");
       return 0;
     }
     if (got == 0) {
@@ -91,10 +171,9 @@ static size_t ReadChars(int fd, char *buf, size_t n, int eof_permitted) {
       }
       break;
     }
-    if ((size_t)got > n - total) {
-      Log("read: overlong read (should never happen)");
+    if (direct) {
+      total += got;
     }
-    total += got;
   }
   return total;
 }
@@ -55,6 +55,9 @@ void WritePacket(int fd, char type, const char *message);
 /**
  * \brief Reads a packet in above form.
  *
+ * To save syscalls, data following the packet may be read ahead and is kept
+ * for the next call; see DiscardPacketBuffer().
+ *
  * \param fd The file descriptor to write to.
  * \param message A pointer to store the message (will be mlock()d).
  *   Will always be set if function returns nonzero; caller must free it.
@@ -64,4 +67,14 @@ void WritePacket(int fd, char type, const char *message);
  */
 char ReadPacket(int fd, char **message, int eof_permitted);
 
+/**
+ * \brief Wipes data read ahead by ReadPacket() from a file descriptor.
+ *
+ * Must be called before closing a file descriptor read from by ReadPacket(),
+ * unless all packets have been read, as the number may be reused.
+ *
+ * \param fd The file descriptor that will be closed.
+ */
+void DiscardPacketBuffer(int fd);
+
 #endif
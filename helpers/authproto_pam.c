@@ -14,14 +14,20 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#include <errno.h>              // for errno, EINTR
+#include <fcntl.h>              // for open, O_RDWR
 #include <locale.h>             // for NULL, setlocale, LC_CTYPE
 #include <security/pam_appl.h>  // for pam_end, pam_start, pam_acct_mgmt
 #include <stdlib.h>             // for free, calloc, exit, getenv
 #include <string.h>             // for strchr
+#include <sys/wait.h>           // for waitpid, WIFEXITED, WEXITSTATUS
+#include <time.h>               // for clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>             // for fork, setsid, dup2, close, _exit
 
 #include "../env_info.h"      // for GetHostName, GetUserName
-#include "../env_settings.h"  // for GetStringSetting
-#include "../logging.h"       // for Log
+#include "../env_settings.h"  // for GetIntSetting, GetStringSetting
+#include "../logging.h"       // for Log, LogErrno
+#include "../secure_arena.h"  // for InitSecureArena
 #include "../util.h"          // for explicit_bzero
 #include "authproto.h"        // for WritePacket, ReadPacket, PTYPE_ERRO...
 
@@ -223,14 +229,77 @@ int Authenticate(struct pam_conv *conv, pam_handle_t **pam) {
   }
 #endif
 
-  // Have the authentication module refresh Kerberos tickets and such
-  // if applicable.
-  int sc_status = pam_setcred(*pam, PAM_REFRESH_CRED);
-  if (sc_status != PAM_SUCCESS) {
-    Log("pam_setcred: status=%d", sc_status);
+  return status;
+}
+
+//! Returns the current time in milliseconds.
+static long long NowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+/*! \brief Has the authentication module refresh Kerberos tickets and such
+ * if applicable.
+ *
+ * \param pam The PAM handle.
+ * \param always_log Whether to log the result also if it is a success.
+ */
+static void RefreshCredentials(pam_handle_t *pam, int always_log) {
+  long long start_ms = NowMs();
+  int status = pam_setcred(pam, PAM_REFRESH_CRED);
+  if (status != PAM_SUCCESS || always_log) {
+    Log("pam_setcred: %s (status=%d, %lld ms)", pam_strerror(pam, status),
+        status, NowMs() - start_ms);
   }
+}
 
-  return status;
+/*! \brief Refreshes credentials in a detached process.
+ *
+ * The process runs in its own session, so killing our process group does not
+ * interrupt it, and has no access to our pipes, so auth_x11 sees our exit
+ * right away. It is orphaned immediately, so init takes care of reaping it.
+ *
+ * \param pam The PAM handle; if this succeeded, the caller must pass
+ *   PAM_DATA_SILENT to pam_end(), as the process still uses the PAM data.
+ * \return Whether the process has been started.
+ */
+static int RefreshCredentialsAsync(pam_handle_t *pam) {
+  pid_t pid = fork();
+  if (pid == -1) {
+    LogErrno("fork");
+    return 0;
+  }
+  if (pid == 0) {
+    setsid();
+    int devnull = open("/dev/null", O_RDWR);
+    if (devnull < 0 || dup2(devnull, 0) < 0 || dup2(devnull, 1) < 0) {
+      LogErrno("/dev/null");
+      _exit(EXIT_FAILURE);
+    }
+    if (devnull > 1) {
+      close(devnull);
+    }
+    pid_t grandchild = fork();
+    if (grandchild == -1) {
+      LogErrno("fork");
+      _exit(EXIT_FAILURE);
+    }
+    if (grandchild != 0) {
+      _exit(EXIT_SUCCESS);
+    }
+    RefreshCredentials(pam, 1);
+    pam_end(pam, PAM_SUCCESS);
+    _exit(EXIT_SUCCESS);
+  }
+  int status;
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      LogErrno("waitpid");
+      return 0;
+    }
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
 }
 
 /*! \brief The main program.
@@ -241,6 +310,8 @@ int Authenticate(struct pam_conv *conv, pam_handle_t **pam) {
  */
 int main() {
   setlocale(LC_CTYPE, "");
+  // For the authproto read buffer; PAM wants responses from malloc().
+  InitSecureArena(SECURE_ARENA_SIZE);
 
   struct pam_conv conv;
   conv.conv = Converse;
@@ -248,7 +319,22 @@ int main() {
 
   pam_handle_t *pam = NULL;
   int status = Authenticate(&conv, &pam);
-  int status2 = pam == NULL ? PAM_SUCCESS : pam_end(pam, status);
+  int end_flags = 0;
+  if (status == PAM_SUCCESS) {
+#ifdef PAM_DATA_SILENT
+    // Report success right away, rather than after e.g. a slow Kerberos
+    // ticket refresh.
+    if (GetIntSetting("XSECURELOCK_PAM_ASYNC_SETCRED", 0) &&
+        RefreshCredentialsAsync(pam)) {
+      end_flags = PAM_DATA_SILENT;
+    } else {
+      RefreshCredentials(pam, 0);
+    }
+#else
+    RefreshCredentials(pam, 0);
+#endif
+  }
+  int status2 = pam == NULL ? PAM_SUCCESS : pam_end(pam, status | end_flags);
 
   if (status != PAM_SUCCESS) {
     // The caller already displayed an error.
@@ -16,16 +16,17 @@ limitations under the License.
 
 #include <X11/X.h>       // for Window, CopyFromParent, CWBackPixel
 #include <X11/Xlib.h>    // for XEvent, XFlush, XNextEvent, XOpenDi...
-#include <signal.h>      // for signal, SIGTERM
+#include <signal.h>      // for sigaction, raise, SIGTERM, SIGTSTP, SIGCONT
 #include <stdio.h>       // for fprintf, NULL, stderr
 #include <stdlib.h>      // for setenv
 #include <string.h>      // for memcmp, memcpy
-#include <sys/select.h>  // for select, FD_SET, FD_ZERO, fd_set
+#include <sys/select.h>  // for select, timeval, FD_SET, FD_ZERO, fd_set
 #include <unistd.h>      // for sleep
 
-#include "../env_settings.h"      // for GetStringSetting
+#include "../env_settings.h"      // for GetIntSetting, GetStringSetting
 #include "../logging.h"           // for Log, LogErrno
-#include "../saver_child.h"       // for MAX_SAVERS
+#include "../restart_policy.h"    // for GetRestartDelayMs
+#include "../saver_child.h"       // for MAX_SAVERS, FreezeSaverChildren
 #include "../wait_pgrp.h"         // for InitWaitPgrp
 #include "../wm_properties.h"     // for SetWMProperties
 #include "../xscreensaver_api.h"  // for ReadWindowID
@@ -40,6 +41,18 @@ static void HandleSIGTERM(int signo) {
   raise(signo);                           // Destroys windows we created anyway.
 }
 
+static void HandleSIGTSTP(int signo) {
+  (void)signo;
+  // Our savers run in process groups of their own, so freeze them first.
+  FreezeSaverChildren(1, 0);
+  raise(SIGSTOP);
+}
+
+static void HandleSIGCONT(int signo) {
+  (void)signo;
+  FreezeSaverChildren(0, 0);
+}
+
 static const char* saver_executable;
 static Display* display;
 static Monitor monitor;
@@ -105,6 +118,14 @@ int main(int argc, char** argv) {
   if (sigaction(SIGUSR1, &sa, NULL) != 0) {
     LogErrno("sigaction(SIGUSR1)");
   }
+  sa.sa_handler = HandleSIGTSTP;  // To freeze children.
+  if (sigaction(SIGTSTP, &sa, NULL) != 0) {
+    LogErrno("sigaction(SIGTSTP)");
+  }
+  sa.sa_handler = HandleSIGCONT;  // To thaw children.
+  if (sigaction(SIGCONT, &sa, NULL) != 0) {
+    LogErrno("sigaction(SIGCONT)");
+  }
   sa.sa_flags = SA_RESETHAND;     // It re-raises to suicide.
   sa.sa_handler = HandleSIGTERM;  // To kill children.
   if (sigaction(SIGTERM, &sa, NULL) != 0) {
@@ -117,7 +138,16 @@ int main(int argc, char** argv) {
     fd_set in_fds;
     FD_ZERO(&in_fds);
     FD_SET(x11_fd, &in_fds);
-    select(x11_fd + 1, &in_fds, 0, 0, NULL);
+    // Wake up to restart the first saver that failed.
+    int restart_ms = -1;
+    for (int i = 0; i < MAX_SAVERS; ++i) {
+      int ms = GetRestartDelayMs(GetSaverChildRestartPolicy(i));
+      if (ms >= 0 && (restart_ms < 0 || ms < restart_ms)) {
+        restart_ms = ms;
+      }
+    }
+    struct timeval timeout = {restart_ms / 1000, (restart_ms % 1000) * 1000};
+    select(x11_fd + 1, &in_fds, 0, 0, restart_ms >= 0 ? &timeout : NULL);
     WatchSaverChild(display, window, 0, saver_executable, 1);
 
     XEvent ev;
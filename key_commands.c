@@ -0,0 +1,174 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "key_commands.h"
+
+#include <X11/X.h>           // for KeySym, NoSymbol
+#include <X11/XF86keysym.h>  // for XF86XK_PowerOff
+#include <X11/Xlib.h>        // for XStringToKeysym
+#include <errno.h>           // for errno
+#include <signal.h>          // for sigemptyset, sigaddset, SIGPIPE
+#include <spawn.h>           // for posix_spawn, posix_spawnattr_init
+#include <stdlib.h>          // for bsearch, malloc, qsort
+#include <string.h>          // for memcpy, strchr, strlen, strncmp
+#include <sys/types.h>       // for pid_t
+
+#include "logging.h"    // for Log, LogErrno
+#include "wait_pgrp.h"  // for WaitProc
+
+//! The environment, for finding all key commands.
+extern char **environ;
+
+//! The prefix and suffix of the XSECURELOCK_KEY_%s_COMMAND settings.
+#define KEY_COMMAND_PREFIX "XSECURELOCK_KEY_"
+#define KEY_COMMAND_SUFFIX "_COMMAND"
+
+//! The maximum number of key commands that may be starting at the same time.
+#define MAX_RUNNING_KEY_COMMANDS 4
+
+//! A key with a command.
+typedef struct {
+  KeySym keysym;
+  //! The shell command; points into the environment.
+  const char *command;
+} KeyCommand;
+
+//! All keys with commands, sorted by keysym.
+static KeyCommand *key_commands = NULL;
+static size_t n_key_commands = 0;
+
+//! The PIDs of the shells currently starting key commands, or 0 for free
+//! slots.
+static pid_t running_key_commands[MAX_RUNNING_KEY_COMMANDS];
+
+static int CompareKeyCommands(const void *a, const void *b) {
+  KeySym ka = ((const KeyCommand *)a)->keysym;
+  KeySym kb = ((const KeyCommand *)b)->keysym;
+  return (ka > kb) - (ka < kb);
+}
+
+void LoadKeyCommands(void) {
+  size_t prefix_len = strlen(KEY_COMMAND_PREFIX);
+  size_t suffix_len = strlen(KEY_COMMAND_SUFFIX);
+  size_t n_vars = 0;
+  for (char **env = environ; *env != NULL; ++env) {
+    ++n_vars;
+  }
+  key_commands = malloc((n_vars ? n_vars : 1) * sizeof(*key_commands));
+  if (key_commands == NULL) {
+    LogErrno("malloc");
+    return;
+  }
+  for (char **env = environ; *env != NULL; ++env) {
+    const char *eq = strchr(*env, '=');
+    if (eq == NULL || eq[1] == 0 ||
+        strncmp(*env, KEY_COMMAND_PREFIX, prefix_len)) {
+      continue;
+    }
+    size_t name_len = (size_t)(eq - *env);
+    if (name_len <= prefix_len + suffix_len ||
+        strncmp(eq - suffix_len, KEY_COMMAND_SUFFIX, suffix_len)) {
+      continue;
+    }
+    char keyname[64];
+    size_t keyname_len = name_len - prefix_len - suffix_len;
+    if (keyname_len >= sizeof(keyname)) {
+      Log("Wow, pretty long keysym names you got there");
+      continue;
+    }
+    memcpy(keyname, *env + prefix_len, keyname_len);
+    keyname[keyname_len] = 0;
+    KeySym keysym = XStringToKeysym(keyname);
+    if (keysym == NoSymbol) {
+      Log("Ignoring command for unknown keysym %s", keyname);
+      continue;
+    }
+    if (keysym == XF86XK_PowerOff) {
+      // Never let a command take over the power key.
+      continue;
+    }
+    key_commands[n_key_commands].keysym = keysym;
+    key_commands[n_key_commands].command = eq + 1;
+    ++n_key_commands;
+  }
+  qsort(key_commands, n_key_commands, sizeof(*key_commands),
+        CompareKeyCommands);
+}
+
+int RunKeyCommand(KeySym keysym) {
+  if (n_key_commands == 0) {
+    return 0;
+  }
+  KeyCommand key = {keysym, NULL};
+  const KeyCommand *found = bsearch(&key, key_commands, n_key_commands,
+                                    sizeof(*key_commands), CompareKeyCommands);
+  if (found == NULL) {
+    return 0;
+  }
+  WatchKeyCommands();
+  int slot = 0;
+  while (slot < MAX_RUNNING_KEY_COMMANDS && running_key_commands[slot] != 0) {
+    ++slot;
+  }
+  if (slot == MAX_RUNNING_KEY_COMMANDS) {
+    Log("Too many key commands starting - ignoring key");
+    return 1;
+  }
+
+  // Spawn the shell directly rather than via system(), which would fork this
+  // process (with all its locked memory) and wait for it. The child must not
+  // inherit our signal mask or the ignored SIGPIPE. The shell runs the command
+  // in the background and exits right away, so long-running commands do not
+  // occupy a slot.
+  posix_spawnattr_t attr;
+  if (posix_spawnattr_init(&attr)) {
+    Log("posix_spawnattr_init failed");
+    return 1;
+  }
+  sigset_t no_signals, default_signals;
+  sigemptyset(&no_signals);
+  sigemptyset(&default_signals);
+  sigaddset(&default_signals, SIGPIPE);
+  posix_spawnattr_setsigmask(&attr, &no_signals);
+  posix_spawnattr_setsigdefault(&attr, &default_signals);
+  short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_SETSID
+  // Detach the command from us, like a daemon.
+  flags |= POSIX_SPAWN_SETSID;
+#endif
+  posix_spawnattr_setflags(&attr, flags);
+  char *const argv[] = {"sh", "-c", "eval \"$1\" &", "sh",
+                        (char *)found->command, NULL};
+  pid_t pid;
+  int err = posix_spawn(&pid, "/bin/sh", NULL, &attr, argv, environ);
+  posix_spawnattr_destroy(&attr);
+  if (err) {
+    errno = err;
+    LogErrno("posix_spawn");
+    return 1;
+  }
+  running_key_commands[slot] = pid;
+  return 1;
+}
+
+void WatchKeyCommands(void) {
+  for (int i = 0; i < MAX_RUNNING_KEY_COMMANDS; ++i) {
+    if (running_key_commands[i] != 0) {
+      int status;
+      WaitProc("key command", &running_key_commands[i], 0, 0, &status);
+    }
+  }
+}
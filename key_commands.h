@@ -0,0 +1,48 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef KEY_COMMANDS_H
+#define KEY_COMMANDS_H
+
+#include <X11/X.h>  // for KeySym
+
+/*! \brief Loads all XSECURELOCK_KEY_%s_COMMAND settings.
+ *
+ * Must be called once at startup, so that handling key presses does not need
+ * to consult the environment.
+ */
+void LoadKeyCommands(void);
+
+/*! \brief Runs the command configured for a key, if any.
+ *
+ * The command is run in the background, detached from us. To avoid spawning
+ * lots of processes while a key is held down, only a limited number of key
+ * commands may be starting at the same time; further key presses are then
+ * ignored.
+ *
+ * \param keysym The key that has been pressed.
+ * \return Nonzero if a command has been configured for the key, i.e. the key
+ *   press has been handled.
+ */
+int RunKeyCommand(KeySym keysym);
+
+/*! \brief Reaps key commands that have terminated.
+ *
+ * Must be called regularly, e.g. after SIGCHLD.
+ */
+void WatchKeyCommands(void);
+
+#endif
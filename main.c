@@ -22,21 +22,22 @@ limitations under the License.
  */
 
 #include <X11/X.h>           // for Window, None, CopyFromParent
+#include <X11/XF86keysym.h>  // for XF86XK_PowerOff
 #include <X11/Xatom.h>       // for XA_CARDINAL, XA_ATOM
 #include <X11/Xlib.h>        // for XEvent, XMapRaised, XSelectInput
 #include <X11/Xcms.h>        // for XcmsFailure
 #include <X11/Xutil.h>       // for XLookupString
 #include <X11/cursorfont.h>  // for XC_arrow
 #include <X11/keysym.h>      // for XK_BackSpace, XK_Tab, XK_o
+#include <errno.h>           // for errno, EINTR
 #include <fcntl.h>           // for fcntl, FD_CLOEXEC, F_GETFD
 #include <locale.h>          // for NULL, setlocale, LC_CTYPE
+#include <poll.h>            // for poll, pollfd, POLLIN
 #include <signal.h>          // for sigaction, raise, sa_handler
 #include <stdio.h>           // for printf, size_t, snprintf
 #include <stdlib.h>          // for exit, system, EXIT_FAILURE
-#include <string.h>          // for memset, strcmp, strncmp
-#include <sys/select.h>      // for select, timeval, fd_set, FD_SET
-#include <sys/time.h>        // for gettimeofday
-#include <time.h>            // for nanosleep, timespec
+#include <string.h>          // for memset, strcmp, strncmp, strrchr
+#include <time.h>            // for clock_gettime, nanosleep, timespec
 #include <unistd.h>          // for _exit, chdir, close, execvp
 
 #ifdef HAVE_DPMS_EXT
@@ -53,6 +54,10 @@ limitations under the License.
 #include <X11/extensions/saver.h>      // for ScreenSaverNotify, ScreenSave...
 #include <X11/extensions/scrnsaver.h>  // for XScreenSaverQueryExtension
 #endif
+#ifdef HAVE_XCB
+#include <X11/Xlib-xcb.h>  // for XGetXCBConnection
+#include <xcb/xcb.h>       // for xcb_grab_pointer, xcb_grab_keyboard
+#endif
 #ifdef HAVE_XF86MISC_EXT
 #include <X11/extensions/xf86misc.h>  // for XF86MiscSetGrabKeysState
 #endif
@@ -61,26 +66,34 @@ limitations under the License.
 #include <X11/extensions/shapeconst.h>  // for ShapeBounding
 #endif
 
-#include "auth_child.h"     // for KillAuthChildSigHandler, Want...
-#include "env_settings.h"   // for GetIntSetting, GetExecutableP...
-#include "logging.h"        // for Log, LogErrno
-#include "mlock_page.h"     // for MLOCK_PAGE
-#include "saver_child.h"    // for WatchSaverChild, KillAllSaver...
-#include "unmap_all.h"      // for ClearUnmapAllWindowsState
-#include "util.h"           // for explicit_bzero
-#include "version.h"        // for git_version
-#include "wait_pgrp.h"      // for WaitPgrp
-#include "wm_properties.h"  // for SetWMProperties
-
-/*! \brief How often (in times per second) to watch child processes.
+#include "auth_child.h"      // for KillAuthChildSigHandler, Want...
+#include "child_cgroup.h"    // for InitChildCgroups, ClearChildCgroups
+#include "env_settings.h"    // for GetIntSetting, GetExecutableP...
+#include "key_commands.h"    // for RunKeyCommand, LoadKeyCommands
+#include "logging.h"         // for Log, LogErrno
+#include "restart_policy.h"  // for RestartPolicy, GetRestartDelayMs
+#include "saver_child.h"     // for WatchSaverChild, KillAllSaver...
+#include "secure_arena.h"    // for SecureAlloc, InitSecureArena
+#include "stacking_order.h"  // for GetTopmostWindow, UpdateStackingOrder
+#include "unmap_all.h"       // for ClearUnmapAllWindowsState
+#include "util.h"            // for explicit_bzero
+#include "version.h"         // for git_version
+#include "wait_pgrp.h"       // for WaitPgrp, GetChildPidfds
+#include "wakeup_pipe.h"     // for InitWakeupPipe, GetWakeupPipeFd
+#include "wm_properties.h"   // for SetWMProperties
+
+/*! \brief How often (in times per second) to perform periodic checks.
  *
- * This defines the minimum frequency to call WatchChildren().
+ * The main loop normally only wakes up for X11 events, signals (including
+ * child process termination) and the blank timer. Only while something needs
+ * retrying (such as reacquiring a lost grab), or if one of the periodic
+ * workarounds below is compiled in, it also wakes up this often.
  */
-#define WATCH_CHILDREN_HZ 10
+#define PERIODIC_CHECKS_HZ 10
 
 /*! \brief Try to reinstate grabs in regular intervals.
  *
- * This will reinstate the grabs WATCH_CHILDREN_HZ times per second. This
+ * This will reinstate the grabs PERIODIC_CHECKS_HZ times per second. This
  * appears to be required with some XScreenSaver hacks that cause XSecureLock to
  * lose MotionNotify events, but nothing else.
  */
@@ -116,7 +129,7 @@ limitations under the License.
    ButtonMotionMask)
 
 //! Private (possibly containing information about the user's password) data.
-//  This data is locked to RAM using mlock() to avoid leakage to disk via swap.
+//  This data lives in the secure arena to avoid leakage to disk via swap.
 struct {
   // The received X event.
   XEvent ev;
@@ -125,7 +138,7 @@ struct {
   KeySym keysym;
   // The length of the data in buf.
   int len;
-} priv;
+} *priv;
 //! The name of the auth child to execute, relative to HELPER_PATH.
 const char *auth_executable;
 //! The name of the saver child to execute, relative to HELPER_PATH.
@@ -140,8 +153,18 @@ int composite_obscurer = 0;
 #endif
 //! If set, we try to force grabbing by "evil" means.
 int force_grab = 0;
+//! Initial delay in microseconds between attempts to grab at startup.
+long grab_retry_min_us = 250;
+//! Maximum delay in microseconds between attempts to grab at startup.
+long grab_retry_max_us = 100000;
+//! Time in milliseconds after which we give up grabbing at startup.
+long grab_timeout_ms = 1000;
 //! If set, print window info about any "conflicting" windows to stderr.
 int debug_window_info = 0;
+//! If set, log how long each phase of establishing the lock took.
+int debug_lock_latency = 0;
+//! If set, log how much memory was locked for secrets when exiting.
+int debug_secure_arena = 0;
 //! If nonnegative, the time in seconds till we blank the screen explicitly.
 int blank_timeout = -1;
 //! The DPMS state to switch the screen to when blanking.
@@ -150,14 +173,82 @@ const char *blank_dpms_state = "off";
 int saver_reset_on_auth_close = 0;
 //! Delay we should wait before starting mapping windows to let children run.
 int saver_delay_ms = 0;
-//! Whetever stopping saver when screen is blanked
+//! Whetever stopping saver when screen is blanked (2: freeze it instead)
 int saver_stop_on_blank = 0;
 
 //! The PID of a currently running notify command, or 0 if none is running.
 pid_t notify_command_pid = 0;
+//! The start count and exit status of the notify command. It is run only once,
+//! so it never gets restarted.
+RestartPolicy notify_command_restart;
+
+//! The time when we will blank the screen (CLOCK_MONOTONIC).
+struct timespec time_to_blank;
+
+//! The phases of establishing the lock, in order.
+enum LockPhase {
+  LOCK_PHASE_START,
+  LOCK_PHASE_DISPLAY_OPEN,
+  LOCK_PHASE_WINDOWS_CREATED,
+  LOCK_PHASE_EXTENSIONS_QUERIED,
+  LOCK_PHASE_GRABBED,
+  LOCK_PHASE_CHILDREN_STARTED,
+  LOCK_PHASE_SAVER_DELAY_DONE,
+  LOCK_PHASE_MAPPED,
+  LOCK_PHASE_VISIBLE,
+  LOCK_PHASE_NOTIFIED,
+  NUM_LOCK_PHASES
+};
+
+//! The names of the lock phases, for logging.
+static const char *const lock_phase_names[NUM_LOCK_PHASES] = {
+    "start",
+    "display_open",
+    "windows_created",
+    "extensions",
+    "grabbed",
+    "children_started",
+    "saver_delay_done",
+    "mapped",
+    "visible",
+    "notified",
+};
+
+//! The times when each lock phase was reached (CLOCK_MONOTONIC).
+struct timespec lock_phase_times[NUM_LOCK_PHASES];
 
-//! The time when we will blank the screen.
-struct timeval time_to_blank;
+//! Records that the given phase of establishing the lock has been reached.
+void MarkLockPhase(enum LockPhase phase) {
+  clock_gettime(CLOCK_MONOTONIC, &lock_phase_times[phase]);
+}
+
+/*! \brief Logs the lock phase times, if enabled.
+ *
+ * Logs a single line of key=value pairs; the times are in milliseconds since
+ * xsecurelock started.
+ *
+ * \param grab_retries How often grabbing had to be retried.
+ */
+void LogLockLatency(int grab_retries) {
+  if (!debug_lock_latency) {
+    return;
+  }
+  char buf[512];
+  size_t pos = 0;
+  for (int i = LOCK_PHASE_START + 1; i < NUM_LOCK_PHASES; ++i) {
+    const struct timespec *t = &lock_phase_times[i];
+    const struct timespec *t0 = &lock_phase_times[LOCK_PHASE_START];
+    double ms = (t->tv_sec - t0->tv_sec) * 1000.0 +
+                (t->tv_nsec - t0->tv_nsec) / 1000000.0;
+    int n = snprintf(buf + pos, sizeof(buf) - pos, " %s_ms=%.3f",
+                     lock_phase_names[i], ms);
+    if (n < 0 || (size_t)n >= sizeof(buf) - pos) {
+      break;
+    }
+    pos += n;
+  }
+  Log("Lock latency:%s grab_retries=%d", buf, grab_retries);
+}
 
 //! Whether the screen is currently blanked by us.
 int blanked = 0;
@@ -174,7 +265,7 @@ void ResetBlankScreenTimer(void) {
   if (blank_timeout < 0) {
     return;
   }
-  gettimeofday(&time_to_blank, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &time_to_blank);
   time_to_blank.tv_sec += blank_timeout;
 }
 
@@ -186,15 +277,31 @@ void InitBlankScreen(void) {
   ResetBlankScreenTimer();
 }
 
-void MaybeBlankScreen(Display *display) {
+/*! \brief Returns the time until the blank timer expires.
+ *
+ * \return The time in milliseconds (rounded up), zero if the timer already
+ *   expired, or -1 if no blanking is pending.
+ */
+int GetBlankScreenTimeoutMs(void) {
   if (blank_timeout < 0 || blanked) {
-    return;
+    return -1;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long long ms = (time_to_blank.tv_sec - now.tv_sec) * 1000LL +
+                 (time_to_blank.tv_nsec - now.tv_nsec + 999999L) / 1000000L;
+  if (ms < 0) {
+    return 0;
+  }
+  if (ms > 1000LL * blank_timeout) {
+    // Clamp in case of rounding issues; also keeps the result in int range.
+    return 1000 * blank_timeout;
   }
-  struct timeval now;
-  gettimeofday(&now, NULL);
-  if (now.tv_sec < time_to_blank.tv_sec ||
-      (now.tv_sec == time_to_blank.tv_sec &&
-       now.tv_usec < time_to_blank.tv_usec)) {
+  return (int)ms;
+}
+
+void MaybeBlankScreen(Display *display) {
+  if (GetBlankScreenTimeoutMs() != 0) {
     return;
   }
   // Blank timer expired - blank the screen.
@@ -261,13 +368,14 @@ void UnblankScreen(Display *display) {
 static void HandleSIGTERM(int signo) {
   KillAllSaverChildrenSigHandler(signo);  // Dirty, but quick.
   KillAuthChildSigHandler(signo);         // More dirty.
-  explicit_bzero(&priv, sizeof(priv));
+  WipeSecureArenaSigHandler();
   raise(signo);
 }
 
 static void HandleSIGUSR2(int unused_signo) {
   (void)unused_signo;
   signal_wakeup = 1;
+  PokeWakeupPipe();
 }
 
 enum WatchChildrenState {
@@ -275,10 +383,26 @@ enum WatchChildrenState {
   WATCH_CHILDREN_NORMAL,
   //! Request no saver to run (DPMS!).
   WATCH_CHILDREN_SAVER_DISABLED,
+  //! Request the saver to be frozen, if running (DPMS!).
+  WATCH_CHILDREN_SAVER_FROZEN,
   //! Request auth child.
   WATCH_CHILDREN_FORCE_AUTH
 };
 
+//! The state to request for the saver while the screen is blanked.
+static enum WatchChildrenState BlankedSaverState(void) {
+  return saver_stop_on_blank == 2 ? WATCH_CHILDREN_SAVER_FROZEN
+                                  : WATCH_CHILDREN_SAVER_DISABLED;
+}
+
+//! Whether the saver child relays SIGTSTP to the savers it spawned.
+static int SaverRelaysFreeze(void) {
+  // Any other saver child is stopped using SIGSTOP, as SIGTSTP is discarded
+  // in its orphaned process group.
+  const char *name = strrchr(saver_executable, '/');
+  return !strcmp(name ? name + 1 : saver_executable, "saver_multiplex");
+}
+
 /*! \brief Watch the child processes, and bring them into the desired state.
  *
  * If the requested state is WATCH_CHILDREN_NORMAL and neither auth nor saver
@@ -287,6 +411,9 @@ enum WatchChildrenState {
  * If the requested state is WATCH_CHILDREN_SAVER_DISABLED, a possibly running
  * saver child will be killed.
  *
+ * If the requested state is WATCH_CHILDREN_SAVER_FROZEN, a possibly running
+ * saver child will be frozen, and thawed again once another state is requested.
+ *
  * If the requested state is WATCH_CHILDREN_FORCE_AUTH, a possibly running saver
  * child will be killed, and an auth child will be spawned.
  *
@@ -305,28 +432,36 @@ int WatchChildren(Display *dpy, Window auth_win, Window saver_win,
   // Note: want_auth is true whenever we WANT to run authentication, or it is
   // already running. It may have recently terminated, which we will notice
   // later.
-  if (want_auth) {
-    // Actually start the auth child, or notice termination.
-    if (WatchAuthChild(auth_win, auth_executable,
-                       state == WATCH_CHILDREN_FORCE_AUTH, stdinbuf,
-                       &auth_running)) {
-      // Auth performed successfully. Terminate the other children.
-      WatchSaverChild(dpy, saver_win, 0, saver_executable, 0);
-      // Now terminate the screen lock.
-      return 1;
-    }
+  //
+  // Actually start the auth child, or notice termination. This is done even if
+  // we do not want auth, as there may be an auth child in standby to maintain.
+  if (WatchAuthChild(auth_win, auth_executable,
+                     state == WATCH_CHILDREN_FORCE_AUTH, stdinbuf,
+                     &auth_running)) {
+    // Auth performed successfully. Terminate the other children.
+    WatchSaverChild(dpy, saver_win, 0, saver_executable, 0);
+    // Now terminate the screen lock.
+    return 1;
+  }
 
+  if (want_auth) {
     // If we wanted auth, but it's not running, auth just terminated. Unmap the
     // auth window and poke the screensaver so that it can reset any timeouts.
+    // The blank timeout is measured since the closing of the auth window.
     if (!auth_running) {
       XUnmapWindow(dpy, auth_win);
       if (saver_reset_on_auth_close) {
         KillAllSaverChildrenSigHandler(SIGUSR1);
       }
+      ResetBlankScreenTimer();
     }
   }
 
   // Show the screen saver.
+  // Even a frozen saver child must be reaped if it dies, e.g. of SIGKILL, as
+  // its pidfd would otherwise keep waking up the main loop.
+  FreezeSaverChildren(state == WATCH_CHILDREN_SAVER_FROZEN,
+                      SaverRelaysFreeze());
   WatchSaverChild(dpy, saver_win, 0, saver_executable,
                   state != WATCH_CHILDREN_SAVER_DISABLED);
 
@@ -433,13 +568,26 @@ void LoadDefaults() {
   composite_obscurer = GetIntSetting("XSECURELOCK_COMPOSITE_OBSCURER", 1);
 #endif
   force_grab = GetIntSetting("XSECURELOCK_FORCE_GRAB", 0);
+  grab_retry_min_us = GetLongSetting("XSECURELOCK_GRAB_RETRY_MIN_US", 250);
+  if (grab_retry_min_us < 1) {
+    grab_retry_min_us = 1;
+  }
+  grab_retry_max_us = GetLongSetting("XSECURELOCK_GRAB_RETRY_MAX_US", 100000);
+  if (grab_retry_max_us < grab_retry_min_us) {
+    grab_retry_max_us = grab_retry_min_us;
+  }
+  grab_timeout_ms = GetLongSetting("XSECURELOCK_GRAB_TIMEOUT_MS", 1000);
   debug_window_info = GetIntSetting("XSECURELOCK_DEBUG_WINDOW_INFO", 0);
+  debug_lock_latency = GetIntSetting("XSECURELOCK_DEBUG_LOCK_LATENCY", 0);
+  debug_secure_arena = GetIntSetting("XSECURELOCK_DEBUG_SECURE_ARENA", 0);
   blank_timeout = GetIntSetting("XSECURELOCK_BLANK_TIMEOUT", 600);
   blank_dpms_state = GetStringSetting("XSECURELOCK_BLANK_DPMS_STATE", "off");
   saver_reset_on_auth_close =
       GetIntSetting("XSECURELOCK_SAVER_RESET_ON_AUTH_CLOSE", 0);
   saver_delay_ms = GetIntSetting("XSECURELOCK_SAVER_DELAY_MS", 0);
   saver_stop_on_blank = GetIntSetting("XSECURELOCK_SAVER_STOP_ON_BLANK", 1);
+  LoadAuthChildSettings();
+  LoadKeyCommands();
 }
 
 /*! \brief Parse the command line arguments, or exit in case of failure.
@@ -538,36 +686,26 @@ void DebugDumpWindowInfo(Window w) {
  *
  * Does not cause any events if the window is already on the top.
 
- * \param display The X11 display.
+ * \param siblings The stacking order of the window and its siblings.
  * \param w The window to raise.
  * \param silent Whether to output something if we can't detect what is wrong.
  * \param force Whether to always raise our window, even if we can't find what
  *   covers us. Set this only if confident that there is something overlapping
  *   us, like in response to a negative VisibilityNotify.
  */
-void MaybeRaiseWindow(Display *display, Window w, int silent, int force) {
+void MaybeRaiseWindow(StackingOrder *siblings, Window w, int silent,
+                      int force) {
   int need_raise = force;
-  Window root, parent;
-  Window *children, *siblings;
-  unsigned int nchildren, nsiblings;
-  if (XQueryTree(display, w, &root, &parent, &children, &nchildren)) {
-    XFree(children);
-    Window grandparent;
-    if (!XQueryTree(display, parent, &root, &grandparent, &siblings,
-                    &nsiblings)) {
-      Log("XQueryTree failed on the parent");
-      siblings = NULL;
-      nsiblings = 0;
-    }
-  } else {
-    Log("XQueryTree failed on self");
-    siblings = NULL;
-    nsiblings = 0;
+  Window top = GetTopmostWindow(siblings);
+  if (force && top == w) {
+    // We have evidence of something covering us, so don't trust the model.
+    InvalidateStackingOrder(siblings);
+    top = GetTopmostWindow(siblings);
   }
-  if (nsiblings == 0) {
+  if (top == None) {
     Log("No siblings found");
   } else {
-    if (w == siblings[nsiblings - 1]) {
+    if (w == top) {
       // But we _are_ on top...?
       if (force && !silent) {
         // We have evidence of something covering us, but cannot locate it.
@@ -577,15 +715,13 @@ void MaybeRaiseWindow(Display *display, Window w, int silent, int force) {
       }
     } else {
       // We found what's covering us.
-      Log("MaybeRaiseWindow hit: window %lu was above my window %lu",
-          siblings[nsiblings - 1], w);
-      DebugDumpWindowInfo(siblings[nsiblings - 1]);
+      Log("MaybeRaiseWindow hit: window %lu was above my window %lu", top, w);
+      DebugDumpWindowInfo(top);
       need_raise = 1;
     }
   }
-  XFree(siblings);
   if (need_raise) {
-    XRaiseWindow(display, w);
+    XRaiseWindow(siblings->display, w);
   }
 }
 
@@ -599,16 +735,42 @@ typedef struct {
 int TryAcquireGrabs(Window w, void *state_voidp) {
   AcquireGrabsState *state = state_voidp;
   int ok = 1;
-  if (XGrabPointer(state->display, state->root_window, False,
+#ifdef HAVE_XCB
+  // Send both grab requests before waiting for any reply, so grabbing only
+  // takes a single round trip.
+  xcb_connection_t *conn = XGetXCBConnection(state->display);
+  xcb_grab_pointer_cookie_t pointer_cookie = xcb_grab_pointer(
+      conn, 0, state->root_window, ALL_POINTER_EVENTS, XCB_GRAB_MODE_ASYNC,
+      XCB_GRAB_MODE_ASYNC, XCB_NONE, state->cursor, XCB_CURRENT_TIME);
+  xcb_grab_keyboard_cookie_t keyboard_cookie =
+      xcb_grab_keyboard(conn, 0, state->root_window, XCB_CURRENT_TIME,
+                        XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+  xcb_grab_pointer_reply_t *pointer_reply =
+      xcb_grab_pointer_reply(conn, pointer_cookie, NULL);
+  int pointer_ok = pointer_reply != NULL &&
+                   pointer_reply->status == XCB_GRAB_STATUS_SUCCESS;
+  free(pointer_reply);
+  xcb_grab_keyboard_reply_t *keyboard_reply =
+      xcb_grab_keyboard_reply(conn, keyboard_cookie, NULL);
+  int keyboard_ok = keyboard_reply != NULL &&
+                    keyboard_reply->status == XCB_GRAB_STATUS_SUCCESS;
+  free(keyboard_reply);
+#else
+  int pointer_ok =
+      XGrabPointer(state->display, state->root_window, False,
                    ALL_POINTER_EVENTS, GrabModeAsync, GrabModeAsync, None,
-                   state->cursor, CurrentTime) != GrabSuccess) {
+                   state->cursor, CurrentTime) == GrabSuccess;
+  int keyboard_ok =
+      XGrabKeyboard(state->display, state->root_window, False, GrabModeAsync,
+                    GrabModeAsync, CurrentTime) == GrabSuccess;
+#endif
+  if (!pointer_ok) {
     if (!state->silent) {
       Log("Critical: cannot grab pointer");
     }
     ok = 0;
   }
-  if (XGrabKeyboard(state->display, state->root_window, False, GrabModeAsync,
-                    GrabModeAsync, CurrentTime) != GrabSuccess) {
+  if (!keyboard_ok) {
     if (!state->silent) {
       Log("Critical: cannot grab keyboard");
     }
@@ -686,8 +848,10 @@ void NotifyOfLock(int xss_sleep_lock_fd) {
   }
   if (notify_command != NULL && *notify_command != NULL) {
     pid_t pid = ForkWithoutSigHandlers();
+    RecordChildStart(&notify_command_restart);
     if (pid == -1) {
       LogErrno("fork");
+      RecordChildExit(&notify_command_restart, "Notify", EXIT_FAILURE, 0);
     } else if (pid == 0) {
       // Child process.
       execvp(notify_command[0], notify_command);
@@ -748,6 +912,7 @@ int CheckLockingEffectiveness() {
  * Usage: see Usage().
  */
 int main(int argc, char **argv) {
+  MarkLockPhase(LOCK_PHASE_START);
   setlocale(LC_CTYPE, "");
 
   int xss_sleep_lock_fd = GetIntSetting("XSS_SLEEP_LOCK_FD", -1);
@@ -784,6 +949,8 @@ int main(int argc, char **argv) {
   // Parse and verify arguments.
   LoadDefaults();
   ParseArgumentsOrExit(argc, argv);
+  // Only warn, as refusing to lock is worse than a misspelled setting.
+  CheckUnknownSettings();
   if (!CheckSettings()) {
     Usage(argv[0]);
     return 1;
@@ -800,6 +967,7 @@ int main(int argc, char **argv) {
     Log("Could not connect to $DISPLAY");
     return 1;
   }
+  MarkLockPhase(LOCK_PHASE_DISPLAY_OPEN);
 
   // TODO(divVerent): Support that?
   if (ScreenCount(display) != 1) {
@@ -816,8 +984,10 @@ int main(int argc, char **argv) {
 
   // Query the initial screen size, and get notified on updates. Also we're
   // going to grab on the root window, so FocusOut events about losing the grab
-  // will appear there.
-  XSelectInput(display, root_window, StructureNotifyMask | FocusChangeMask);
+  // will appear there. Changes to the stacking order of the top-level windows
+  // are tracked too.
+  XSelectInput(display, root_window,
+               StructureNotifyMask | SubstructureNotifyMask | FocusChangeMask);
   int w = DisplayWidth(display, DefaultScreen(display));
   int h = DisplayHeight(display, DefaultScreen(display));
 #ifdef DEBUG_EVENTS
@@ -942,7 +1112,8 @@ int main(int argc, char **argv) {
 #ifdef HAVE_XCOMPOSITE_EXT
   if (composite_window != None) {
     XSelectInput(display, composite_window,
-                 StructureNotifyMask | VisibilityChangeMask);
+                 StructureNotifyMask | SubstructureNotifyMask |
+                     VisibilityChangeMask);
   }
   if (obscurer_window != None) {
     XSelectInput(display, obscurer_window,
@@ -950,11 +1121,27 @@ int main(int argc, char **argv) {
   }
 #endif
   XSelectInput(display, background_window,
-               StructureNotifyMask | VisibilityChangeMask);
+               StructureNotifyMask | SubstructureNotifyMask |
+                   VisibilityChangeMask);
   XSelectInput(display, saver_window, StructureNotifyMask);
   XSelectInput(display, auth_window,
                StructureNotifyMask | VisibilityChangeMask);
 
+  // Keep track of who is on top of our windows without having to ask the X
+  // server all the time.
+  StackingOrder root_stacking, background_stacking;
+  InitStackingOrder(&root_stacking, display, root_window);
+  InitStackingOrder(&background_stacking, display, background_window);
+  StackingOrder *background_siblings = &root_stacking;
+#ifdef HAVE_XCOMPOSITE_EXT
+  StackingOrder composite_stacking;
+  InitStackingOrder(&composite_stacking, display, composite_window);
+  if (composite_window != None) {
+    background_siblings = &composite_stacking;
+  }
+#endif
+  MarkLockPhase(LOCK_PHASE_WINDOWS_CREATED);
+
   // Make sure we stay always on top.
   XWindowChanges coverchanges;
   coverchanges.stack_mode = Above;
@@ -1031,6 +1218,7 @@ int main(int argc, char **argv) {
   }
   XScreenSaverSelectInput(display, background_window, ScreenSaverNotifyMask);
 #endif
+  MarkLockPhase(LOCK_PHASE_EXTENSIONS_QUERIED);
 
 #ifdef HAVE_XF86MISC_EXT
   // In case keys to disable grabs are available, turn them off for the duration
@@ -1042,18 +1230,31 @@ int main(int argc, char **argv) {
 #endif
 
   // Acquire all grabs we need. Retry in case the window manager is still
-  // holding some grabs while starting XSecureLock.
-  int last_normal_attempt = force_grab ? 1 : 0;
+  // holding some grabs while starting XSecureLock. Such grabs are usually
+  // released very soon, so retry quickly at first and back off exponentially.
   Window previous_focused_window = None;
   int previous_revert_focus_to = RevertToNone;
-  int retries = 10;
-  for (; retries >= 0; --retries) {
+  struct timespec grab_start;
+  clock_gettime(CLOCK_MONOTONIC, &grab_start);
+  long grab_elapsed_us = 0;
+  long grab_delay_us = grab_retry_min_us;
+  int grab_retries = 0;
+  for (;; ++grab_retries) {
+    int last_attempt = grab_elapsed_us >= grab_timeout_ms * 1000;
     if (AcquireGrabs(display, root_window, my_windows, n_my_windows,
-                     transparent_cursor,
-                     /*silent=*/retries > last_normal_attempt,
-                     /*force=*/retries < last_normal_attempt)) {
+                     transparent_cursor, /*silent=*/!last_attempt,
+                     /*force=*/0)) {
       break;
     }
+    if (last_attempt) {
+      if (force_grab &&
+          AcquireGrabs(display, root_window, my_windows, n_my_windows,
+                       transparent_cursor, /*silent=*/0, /*force=*/1)) {
+        break;
+      }
+      Log("Failed to grab. Giving up.");
+      return EXIT_FAILURE;
+    }
     if (previous_focused_window == None) {
       // When retrying for the first time, try to change the X11 input focus.
       // This may close context menus and thereby allow us to grab.
@@ -1066,15 +1267,33 @@ int main(int argc, char **argv) {
       // Make this happen instantly.
       XFlush(display);
     }
-    nanosleep(&(const struct timespec){0, 100000000L}, NULL);
+    // Do not sleep past the timeout, so the last attempt happens on time.
+    long sleep_us = grab_timeout_ms * 1000 - grab_elapsed_us;
+    if (sleep_us > grab_delay_us) {
+      sleep_us = grab_delay_us;
+    }
+    nanosleep(&(const struct timespec){sleep_us / 1000000,
+                                       (sleep_us % 1000000) * 1000},
+              NULL);
+    grab_delay_us *= 2;
+    if (grab_delay_us > grab_retry_max_us) {
+      grab_delay_us = grab_retry_max_us;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    grab_elapsed_us = (now.tv_sec - grab_start.tv_sec) * 1000000L +
+                      (now.tv_nsec - grab_start.tv_nsec) / 1000;
   }
-  if (retries < 0) {
-    Log("Failed to grab. Giving up.");
-    return EXIT_FAILURE;
+  MarkLockPhase(LOCK_PHASE_GRABBED);
+  if (grab_retries > 0) {
+    Log("Grabbing succeeded after %d retries and %ld ms", grab_retries,
+        grab_elapsed_us / 1000);
   }
 
-  if (MLOCK_PAGE(&priv, sizeof(priv)) < 0) {
-    LogErrno("mlock");
+  if (InitSecureArena(SECURE_ARENA_SIZE) < 0 ||
+      (priv = SecureAlloc(sizeof(*priv))) == NULL ||
+      LockAuthChildQueue() < 0) {
+    Log("Could not lock memory for secrets");
     return EXIT_FAILURE;
   }
 
@@ -1095,6 +1314,15 @@ int main(int argc, char **argv) {
     LogErrno("sigaction(SIGTERM)");
   }
 
+  // Must be set up before any child process is spawned.
+  InitChildCgroups();
+
+  // Must be set up before any signal handler that wants to wake up the main
+  // loop can run.
+  if (InitWakeupPipe()) {
+    Log("Could not create wakeup pipe");
+    return EXIT_FAILURE;
+  }
   InitWaitPgrp();
 
   // Need to flush the display so savers sure can access the window.
@@ -1107,7 +1335,7 @@ int main(int argc, char **argv) {
     XScreenSaverInfo *info = XScreenSaverAllocInfo();
     XScreenSaverQueryInfo(display, root_window, info);
     if (info->state == ScreenSaverOn && info->kind == ScreenSaverBlanked && saver_stop_on_blank) {
-      xss_requested_saver_state = WATCH_CHILDREN_SAVER_DISABLED;
+      xss_requested_saver_state = BlankedSaverState();
     }
     XFree(info);
   }
@@ -1120,12 +1348,14 @@ int main(int argc, char **argv) {
                     NULL)) {
     goto done;
   }
+  MarkLockPhase(LOCK_PHASE_CHILDREN_STARTED);
 
   // Wait for children to initialize.
   struct timespec sleep_ts;
   sleep_ts.tv_sec = saver_delay_ms / 1000;
   sleep_ts.tv_nsec = (saver_delay_ms % 1000) * 1000000L;
   nanosleep(&sleep_ts, NULL);
+  MarkLockPhase(LOCK_PHASE_SAVER_DELAY_DONE);
 
   // Map our windows.
   // This is done after grabbing so failure to grab does not blank the screen
@@ -1142,6 +1372,7 @@ int main(int argc, char **argv) {
   }
 #endif
   XFlush(display);
+  MarkLockPhase(LOCK_PHASE_MAPPED);
 
   // Prevent X11 errors from killing XSecureLock. Instead, just keep going.
   XSetErrorHandler(JustLogErrorsHandler);
@@ -1157,20 +1388,18 @@ int main(int argc, char **argv) {
   int background_window_mapped = 0, background_window_visible = 0,
       auth_window_mapped = 0, saver_window_mapped = 0,
       need_to_reinstate_grabs = 0, xss_lock_notified = 0;
+  struct pollfd pfds[4 + MAX_CHILD_PIDFDS];
+  int child_fds[MAX_CHILD_PIDFDS];
+  pfds[0].fd = x11_fd;
+  pfds[0].events = POLLIN;
+  pfds[1].fd = GetWakeupPipeFd();
+  pfds[1].events = POLLIN;
+  pfds[2].events = POLLIN;
+  pfds[3].events = POLLOUT;
   for (;;) {
-    // Watch children WATCH_CHILDREN_HZ times per second.
-    fd_set in_fds;
-    memset(&in_fds, 0, sizeof(in_fds));  // For clang-analyzer.
-    FD_ZERO(&in_fds);
-    FD_SET(x11_fd, &in_fds);
-    struct timeval tv;
-    tv.tv_usec = 1000000 / WATCH_CHILDREN_HZ;
-    tv.tv_sec = 0;
-    select(x11_fd + 1, &in_fds, 0, 0, &tv);
-
     // Make sure to shut down the saver when blanked. Saves power.
     enum WatchChildrenState requested_saver_state =
-      (saver_stop_on_blank && blanked) ? WATCH_CHILDREN_SAVER_DISABLED : xss_requested_saver_state;
+      (saver_stop_on_blank && blanked) ? BlankedSaverState() : xss_requested_saver_state;
 
     // Now check status of our children.
     if (WatchChildren(display, auth_window, saver_window, requested_saver_state,
@@ -1198,12 +1427,12 @@ int main(int argc, char **argv) {
 
 #ifdef AUTO_RAISE
     if (auth_window_mapped) {
-      MaybeRaiseWindow(display, auth_window, 0, 0);
+      MaybeRaiseWindow(&background_stacking, auth_window, 0, 0);
     }
-    MaybeRaiseWindow(display, background_window, 0, 0);
+    MaybeRaiseWindow(background_siblings, background_window, 0, 0);
 #ifdef HAVE_XCOMPOSITE_EXT
     if (obscurer_window != None) {
-      MaybeRaiseWindow(display, obscurer_window, 1, 0);
+      MaybeRaiseWindow(&root_stacking, obscurer_window, 1, 0);
     }
 #endif
 #endif
@@ -1211,9 +1440,69 @@ int main(int argc, char **argv) {
     // Take care of zombies.
     if (notify_command_pid != 0) {
       int status;
-      WaitProc("notify", &notify_command_pid, 0, 0, &status);
+      if (WaitProc("notify", &notify_command_pid, 0, 0, &status)) {
+        RecordChildExit(&notify_command_restart, "Notify", status, 1);
+      }
       // Otherwise, we're still alive. Re-check next time.
     }
+    WatchKeyCommands();
+
+    // Sleep until something happens: an X11 event, a signal (such as a child
+    // process terminating), or a deadline of ours expiring.
+    int timeout_ms = GetBlankScreenTimeoutMs();
+    if (WantAuthChild(0)) {
+      // While auth is running, we never blank.
+      timeout_ms = -1;
+    }
+    // Wake up to restart children that failed.
+    int restart_ms[2] = {
+        GetRestartDelayMs(GetSaverChildRestartPolicy(0)),
+        GetRestartDelayMs(GetAuthChildRestartPolicy())};
+    for (int i = 0; i < 2; ++i) {
+      if (restart_ms[i] >= 0 &&
+          (timeout_ms < 0 || timeout_ms > restart_ms[i])) {
+        timeout_ms = restart_ms[i];
+      }
+    }
+    int need_periodic_checks = need_to_reinstate_grabs;
+#if defined(ALWAYS_REINSTATE_GRABS) || defined(AUTO_RAISE)
+    // These workarounds need polling.
+    need_periodic_checks = 1;
+#endif
+    if (need_periodic_checks) {
+      const int periodic_ms = 1000 / PERIODIC_CHECKS_HZ;
+      if (timeout_ms < 0 || timeout_ms > periodic_ms) {
+        timeout_ms = periodic_ms;
+      }
+    }
+    if (saver_stop_on_blank && blanked &&
+        requested_saver_state != BlankedSaverState()) {
+      // We just blanked; loop again right away to shut down the saver.
+      timeout_ms = 0;
+    }
+    // Events may have been read into the Xlib queue already, and requests may
+    // still be pending in the output buffer.
+    XFlush(display);
+    if (XQLength(display) > 0) {
+      timeout_ms = 0;
+    }
+    // Child processes we track using pidfds wake us up when they exit. Others
+    // do so via SIGCHLD and the wakeup pipe.
+    int n_child_fds = GetChildPidfds(child_fds, MAX_CHILD_PIDFDS);
+    for (int i = 0; i < n_child_fds; ++i) {
+      pfds[4 + i].fd = child_fds[i];
+      pfds[4 + i].events = POLLIN;
+    }
+    // A persistent auth child tells us when it's done with an attempt.
+    pfds[2].fd = GetAuthChildStatusFd();
+    // Key presses are sent to the auth child only once it reads them, so a
+    // stalled auth child can't block us.
+    FlushAuthChildQueue();
+    pfds[3].fd = GetAuthChildQueueFd();
+    if (poll(pfds, 4 + n_child_fds, timeout_ms) < 0 && errno != EINTR) {
+      LogErrno("poll");
+    }
+    DrainWakeupPipe();
 
     if (signal_wakeup) {
       // A signal was received to request a wakeup. Clear the flag
@@ -1232,22 +1521,31 @@ int main(int argc, char **argv) {
     }
 
     // Handle all events.
-    while (XPending(display) && (XNextEvent(display, &priv.ev), 1)) {
-      if (XFilterEvent(&priv.ev, None)) {
+    while (XPending(display) && (XNextEvent(display, &priv->ev), 1)) {
+      if (XFilterEvent(&priv->ev, None)) {
         // If an input method ate the event, ignore it.
         continue;
       }
-      switch (priv.ev.type) {
+      if (UpdateStackingOrder(&root_stacking, &priv->ev) ||
+#ifdef HAVE_XCOMPOSITE_EXT
+          (composite_window != None &&
+           UpdateStackingOrder(&composite_stacking, &priv->ev)) ||
+#endif
+          UpdateStackingOrder(&background_stacking, &priv->ev)) {
+        // Only relevant for tracking the stacking order.
+        continue;
+      }
+      switch (priv->ev.type) {
         case ConfigureNotify:
 #ifdef DEBUG_EVENTS
           Log("ConfigureNotify %lu %d %d",
-              (unsigned long)priv.ev.xconfigure.window,
-              priv.ev.xconfigure.width, priv.ev.xconfigure.height);
+              (unsigned long)priv->ev.xconfigure.window,
+              priv->ev.xconfigure.width, priv->ev.xconfigure.height);
 #endif
-          if (priv.ev.xconfigure.window == root_window) {
+          if (priv->ev.xconfigure.window == root_window) {
             // Root window size changed. Adjust the saver_window window too!
-            w = priv.ev.xconfigure.width;
-            h = priv.ev.xconfigure.height;
+            w = priv->ev.xconfigure.width;
+            h = priv->ev.xconfigure.height;
 #ifdef DEBUG_EVENTS
             Log("DisplayWidthHeight %d %d", w, h);
 #endif
@@ -1264,52 +1562,56 @@ int main(int argc, char **argv) {
           }
           // Also, whatever window has been reconfigured, should also be raised
           // to make sure.
-          if (auth_window_mapped && priv.ev.xconfigure.window == auth_window) {
-            MaybeRaiseWindow(display, auth_window, 0, 0);
-          } else if (priv.ev.xconfigure.window == background_window) {
-            MaybeRaiseWindow(display, background_window, 0, 0);
+          if (auth_window_mapped && priv->ev.xconfigure.window == auth_window) {
+            MaybeRaiseWindow(&background_stacking, auth_window, 0, 0);
+          } else if (priv->ev.xconfigure.window == background_window) {
+            MaybeRaiseWindow(background_siblings, background_window, 0, 0);
             XClearWindow(display,
                          background_window);  // Workaround for bad drivers.
 #ifdef HAVE_XCOMPOSITE_EXT
           } else if (obscurer_window != None &&
-                     priv.ev.xconfigure.window == obscurer_window) {
-            MaybeRaiseWindow(display, obscurer_window, 1, 0);
+                     priv->ev.xconfigure.window == obscurer_window) {
+            MaybeRaiseWindow(&root_stacking, obscurer_window, 1, 0);
 #endif
           }
           break;
         case VisibilityNotify:
 #ifdef DEBUG_EVENTS
           Log("VisibilityNotify %lu %d",
-              (unsigned long)priv.ev.xvisibility.window,
-              priv.ev.xvisibility.state);
+              (unsigned long)priv->ev.xvisibility.window,
+              priv->ev.xvisibility.state);
 #endif
-          if (priv.ev.xvisibility.state == VisibilityUnobscured) {
-            if (priv.ev.xvisibility.window == background_window) {
+          if (priv->ev.xvisibility.state == VisibilityUnobscured) {
+            if (priv->ev.xvisibility.window == background_window) {
+              if (!xss_lock_notified) {
+                MarkLockPhase(LOCK_PHASE_VISIBLE);
+              }
               background_window_visible = 1;
             }
           } else {
             // If something else shows an OverrideRedirect window, we want to
             // stay on top.
             if (auth_window_mapped &&
-                priv.ev.xvisibility.window == auth_window) {
+                priv->ev.xvisibility.window == auth_window) {
               Log("Someone overlapped the auth window. Undoing that");
-              MaybeRaiseWindow(display, auth_window, 0, 1);
-            } else if (priv.ev.xvisibility.window == background_window) {
+              MaybeRaiseWindow(&background_stacking, auth_window, 0, 1);
+            } else if (priv->ev.xvisibility.window == background_window) {
               background_window_visible = 0;
               Log("Someone overlapped the background window. Undoing that");
-              MaybeRaiseWindow(display, background_window, 0, 1);
+              MaybeRaiseWindow(background_siblings, background_window, 0,
+                               1);
               XClearWindow(display,
                            background_window);  // Workaround for bad drivers.
 #ifdef HAVE_XCOMPOSITE_EXT
             } else if (obscurer_window != None &&
-                       priv.ev.xvisibility.window == obscurer_window) {
+                       priv->ev.xvisibility.window == obscurer_window) {
               // Not logging this as our own composite overlay window causes
               // this to happen too; keeping this there anyway so we self-raise
               // if something is wrong with the COW and something else overlaps
               // us.
-              MaybeRaiseWindow(display, obscurer_window, 1, 1);
+              MaybeRaiseWindow(&root_stacking, obscurer_window, 1, 1);
             } else if (composite_window != None &&
-                       priv.ev.xvisibility.window == composite_window) {
+                       priv->ev.xvisibility.window == composite_window) {
               Log("Someone overlapped the composite overlay window window. "
                   "Undoing that");
               // Note: MaybeRaiseWindow isn't valid here, as the COW has the
@@ -1319,7 +1621,7 @@ int main(int argc, char **argv) {
 #endif
             } else {
               Log("Received unexpected VisibilityNotify for window %lu",
-                  priv.ev.xvisibility.window);
+                  priv->ev.xvisibility.window);
             }
           }
           break;
@@ -1337,13 +1639,13 @@ int main(int argc, char **argv) {
           Status status = XLookupNone;
           int have_key = 1;
           int do_wake_up = 1;
-          priv.keysym = NoSymbol;
+          priv->keysym = NoSymbol;
           if (xic) {
             // This uses the current locale.
-            priv.len =
-                XmbLookupString(xic, &priv.ev.xkey, priv.buf,
-                                sizeof(priv.buf) - 1, &priv.keysym, &status);
-            if (priv.len <= 0) {
+            priv->len =
+                XmbLookupString(xic, &priv->ev.xkey, priv->buf,
+                                sizeof(priv->buf) - 1, &priv->keysym, &status);
+            if (priv->len <= 0) {
               // Error or no output. Fine.
               have_key = 0;
             } else if (status != XLookupChars && status != XLookupBoth) {
@@ -1352,71 +1654,51 @@ int main(int argc, char **argv) {
             }
           } else {
             // This is always Latin-1. Sorry.
-            priv.len = XLookupString(&priv.ev.xkey, priv.buf,
-                                     sizeof(priv.buf) - 1, &priv.keysym, NULL);
-            if (priv.len <= 0) {
+            priv->len = XLookupString(&priv->ev.xkey, priv->buf,
+                                     sizeof(priv->buf) - 1, &priv->keysym, NULL);
+            if (priv->len <= 0) {
               // Error or no output. Fine.
               have_key = 0;
             }
           }
-          if (have_key && (size_t)priv.len >= sizeof(priv.buf)) {
+          if (have_key && (size_t)priv->len >= sizeof(priv->buf)) {
             // Detect possible overruns. This should be unreachable.
-            Log("Received invalid length from XLookupString: %d", priv.len);
+            Log("Received invalid length from XLookupString: %d", priv->len);
             have_key = 0;
           }
-          if (priv.keysym == XK_Tab && (priv.ev.xkey.state & ControlMask)) {
+          if (priv->keysym == XK_Tab && (priv->ev.xkey.state & ControlMask)) {
             // Map Ctrl-Tab to Ctrl-S (switch layout). We remap this one
             // because not all layouts have a key for S.
-            priv.buf[0] = '\023';
-            priv.buf[1] = 0;
-          } else if (priv.keysym == XK_BackSpace &&
-                     (priv.ev.xkey.state & ControlMask)) {
+            priv->buf[0] = '\023';
+            priv->buf[1] = 0;
+          } else if (priv->keysym == XK_BackSpace &&
+                     (priv->ev.xkey.state & ControlMask)) {
             // Map Ctrl-Backspace to Ctrl-U (clear entry line).
-            priv.buf[0] = '\025';
-            priv.buf[1] = 0;
+            priv->buf[0] = '\025';
+            priv->buf[1] = 0;
           } else if (have_key) {
             // Map all newline-like things to newlines.
-            if (priv.len == 1 && priv.buf[0] == '\r') {
-              priv.buf[0] = '\n';
+            if (priv->len == 1 && priv->buf[0] == '\r') {
+              priv->buf[0] = '\n';
             }
-            priv.buf[priv.len] = 0;
+            priv->buf[priv->len] = 0;
           } else {
             // No new bytes. Fine.
-            priv.buf[0] = 0;
+            priv->buf[0] = 0;
             // We do check if something external wants to handle this key,
-            // though.
-            const char *keyname = XKeysymToString(priv.keysym);
-            if (keyname != NULL && strcmp(keyname, "XF86PowerOff") != 0) {
-              char buf[64];
-              int buflen = snprintf(buf, sizeof(buf), "XSECURELOCK_KEY_%s_COMMAND", keyname);
-
-              if (buflen <= 0 || (size_t)buflen >= sizeof(buf)) {
-                Log("Wow, pretty long keysym names you got there");
-              } else {
-                const char *command = GetStringSetting(buf, "");
-                if (*command) {
-                  buflen = snprintf(buf, sizeof(buf),
-                                    "eval \"$XSECURELOCK_KEY_%s_COMMAND\" &",
-                                    keyname);
-                  if (buflen <= 0 || (size_t)buflen >= sizeof(buf)) {
-                    Log("Wow, pretty long keysym names you got there");
-                  } else {
-                    system(buf);
-                    do_wake_up = 0;
-                  }
-                }
-              }
-            } else {
+            // though. Unnamed keys and the power key never wake up.
+            if (XKeysymToString(priv->keysym) == NULL ||
+                priv->keysym == XF86XK_PowerOff || RunKeyCommand(priv->keysym)) {
               do_wake_up = 0;
             }
           }
           // Now if so desired, wake up the login prompt, and check its
           // status.
           int authenticated =
-              do_wake_up ? WakeUp(display, auth_window, saver_window, priv.buf)
+              do_wake_up ? WakeUp(display, auth_window, saver_window, priv->buf)
                          : 0;
           // Clear out keypress data immediately.
-          explicit_bzero(&priv, sizeof(priv));
+          explicit_bzero(priv, sizeof(*priv));
           if (authenticated) {
             goto done;
           }
@@ -1433,9 +1715,9 @@ int main(int argc, char **argv) {
           break;
         case MapNotify:
 #ifdef DEBUG_EVENTS
-          Log("MapNotify %lu", (unsigned long)priv.ev.xmap.window);
+          Log("MapNotify %lu", (unsigned long)priv->ev.xmap.window);
 #endif
-          if (priv.ev.xmap.window == auth_window) {
+          if (priv->ev.xmap.window == auth_window) {
             auth_window_mapped = 1;
 #ifdef SHOW_CURSOR_DURING_AUTH
             // Actually ShowCursor...
@@ -1443,17 +1725,17 @@ int main(int argc, char **argv) {
                          GrabModeAsync, GrabModeAsync, None, default_cursor,
                          CurrentTime);
 #endif
-          } else if (priv.ev.xmap.window == saver_window) {
+          } else if (priv->ev.xmap.window == saver_window) {
             saver_window_mapped = 1;
-          } else if (priv.ev.xmap.window == background_window) {
+          } else if (priv->ev.xmap.window == background_window) {
             background_window_mapped = 1;
           }
           break;
         case UnmapNotify:
 #ifdef DEBUG_EVENTS
-          Log("UnmapNotify %lu", (unsigned long)priv.ev.xmap.window);
+          Log("UnmapNotify %lu", (unsigned long)priv->ev.xmap.window);
 #endif
-          if (priv.ev.xmap.window == auth_window) {
+          if (priv->ev.xmap.window == auth_window) {
             auth_window_mapped = 0;
 #ifdef SHOW_CURSOR_DURING_AUTH
             // Actually HideCursor...
@@ -1461,12 +1743,12 @@ int main(int argc, char **argv) {
                          GrabModeAsync, GrabModeAsync, None, transparent_cursor,
                          CurrentTime);
 #endif
-          } else if (priv.ev.xmap.window == saver_window) {
+          } else if (priv->ev.xmap.window == saver_window) {
             // This should never happen, but let's handle it anyway.
             Log("Someone unmapped the saver window. Undoing that");
             saver_window_mapped = 0;
             XMapWindow(display, saver_window);
-          } else if (priv.ev.xmap.window == background_window) {
+          } else if (priv->ev.xmap.window == background_window) {
             // This should never happen, but let's handle it anyway.
             Log("Someone unmapped the background window. Undoing that");
             background_window_mapped = 0;
@@ -1475,12 +1757,12 @@ int main(int argc, char **argv) {
                          background_window);  // Workaround for bad drivers.
 #ifdef HAVE_XCOMPOSITE_EXT
           } else if (obscurer_window != None &&
-                     priv.ev.xmap.window == obscurer_window) {
+                     priv->ev.xmap.window == obscurer_window) {
             // This should never happen, but let's handle it anyway.
             Log("Someone unmapped the obscurer window. Undoing that");
             XMapRaised(display, obscurer_window);
           } else if (composite_window != None &&
-                     priv.ev.xmap.window == composite_window) {
+                     priv->ev.xmap.window == composite_window) {
             // This should never happen, but let's handle it anyway.
             // Compton might do this when --unredir-if-possible is set and a
             // fullscreen game launches while the screen is locked.
@@ -1488,7 +1770,7 @@ int main(int argc, char **argv) {
                 "that");
             XMapRaised(display, composite_window);
 #endif
-          } else if (priv.ev.xmap.window == root_window) {
+          } else if (priv->ev.xmap.window == root_window) {
             // This should never happen, but let's handle it anyway.
             Log("Someone unmapped the root window?!? Undoing that");
             XMapRaised(display, root_window);
@@ -1497,11 +1779,11 @@ int main(int argc, char **argv) {
         case FocusIn:
         case FocusOut:
 #ifdef DEBUG_EVENTS
-          Log("Focus%d %lu", priv.ev.xfocus.mode,
-              (unsigned long)priv.ev.xfocus.window);
+          Log("Focus%d %lu", priv->ev.xfocus.mode,
+              (unsigned long)priv->ev.xfocus.window);
 #endif
-          if (priv.ev.xfocus.window == root_window &&
-              priv.ev.xfocus.mode == NotifyUngrab) {
+          if (priv->ev.xfocus.window == root_window &&
+              priv->ev.xfocus.mode == NotifyUngrab) {
             // Not logging this - this is a normal occurrence if invoking the
             // screen lock from a key combination, as the press event may
             // launch xsecurelock while the release event releases a passive
@@ -1515,7 +1797,7 @@ int main(int argc, char **argv) {
           }
           break;
         case ClientMessage: {
-          if (priv.ev.xclient.window == root_window) {
+          if (priv->ev.xclient.window == root_window) {
             // ClientMessage on root window is used by the EWMH spec. No need to
             // spam about those. As we want to watch the root window size,
             // we must keep selecting StructureNotifyMask there.
@@ -1524,38 +1806,40 @@ int main(int argc, char **argv) {
           // Those cause spam below, so let's log them separately to get some
           // details.
           const char *message_type =
-              XGetAtomName(display, priv.ev.xclient.message_type);
+              XGetAtomName(display, priv->ev.xclient.message_type);
           Log("Received unexpected ClientMessage event %s on window %lu",
               message_type == NULL ? "(null)" : message_type,
-              priv.ev.xclient.window);
+              priv->ev.xclient.window);
           break;
         }
         default:
 #ifdef DEBUG_EVENTS
-          Log("Event%d %lu", priv.ev.type, (unsigned long)priv.ev.xany.window);
+          Log("Event%d %lu", priv->ev.type, (unsigned long)priv->ev.xany.window);
 #endif
 #ifdef HAVE_XSCREENSAVER_EXT
           // Handle screen saver notifications. If the screen is blanked
           // anyway, turn off the saver child.
           if (scrnsaver_event_base != 0 &&
-              priv.ev.type == scrnsaver_event_base + ScreenSaverNotify) {
+              priv->ev.type == scrnsaver_event_base + ScreenSaverNotify) {
             XScreenSaverNotifyEvent *xss_ev =
-                (XScreenSaverNotifyEvent *)&priv.ev;
+                (XScreenSaverNotifyEvent *)&priv->ev;
             if (xss_ev->state == ScreenSaverOn) {
-              xss_requested_saver_state = WATCH_CHILDREN_SAVER_DISABLED;
+              xss_requested_saver_state = BlankedSaverState();
             } else {
               xss_requested_saver_state = WATCH_CHILDREN_NORMAL;
             }
             break;
           }
 #endif
-          Log("Received unexpected event %d", priv.ev.type);
+          Log("Received unexpected event %d", priv->ev.type);
           break;
       }
       if (background_window_mapped && background_window_visible &&
           saver_window_mapped && !xss_lock_notified) {
         NotifyOfLock(xss_sleep_lock_fd);
         xss_lock_notified = 1;
+        MarkLockPhase(LOCK_PHASE_NOTIFIED);
+        LogLockLatency(grab_retries);
       }
     }
   }
@@ -1572,7 +1856,12 @@ done:
   }
 
   // Wipe the password.
-  explicit_bzero(&priv, sizeof(priv));
+  explicit_bzero(priv, sizeof(*priv));
+  if (debug_secure_arena) {
+    Log("Secure arena: %lu bytes locked, at most %lu bytes used",
+        (unsigned long)GetSecureArenaLockedBytes(),
+        (unsigned long)GetSecureArenaPeakBytes());
+  }
 
   // Free our resources, and exit.
 #ifdef HAVE_XCOMPOSITE_EXT
@@ -1592,6 +1881,13 @@ done:
   XFreeCursor(display, default_cursor);
   XFreePixmap(display, bg);
 
+  ClearStackingOrder(&root_stacking);
+  ClearStackingOrder(&background_stacking);
+#ifdef HAVE_XCOMPOSITE_EXT
+  ClearStackingOrder(&composite_stacking);
+#endif
+  ClearChildCgroups();
+
   XCloseDisplay(display);
 
   return EXIT_SUCCESS;
@@ -0,0 +1,127 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "restart_policy.h"
+
+#include <stdlib.h>  // for rand_r
+#include <string.h>  // for memset
+#include <time.h>    // for clock_gettime, timespec, CLOCK_MONOTONIC
+#include <unistd.h>  // for getpid
+
+#include "logging.h"  // for Log
+
+//! The state of the jitter generator, or 0 if not seeded yet.
+static unsigned int jitter_seed = 0;
+
+/*! \brief Returns a random jitter between 0 and max_ms.
+ *
+ * Seeded per process, so that several of our processes (e.g. xsecurelock and
+ * saver_multiplex) do not restart their children in lockstep either.
+ */
+static long long RandomJitterMs(const struct timespec *now, long long max_ms) {
+  if (jitter_seed == 0) {
+    jitter_seed = ((unsigned int)getpid() * 2654435761U) ^
+                  (unsigned int)now->tv_nsec ^ (unsigned int)now->tv_sec;
+    if (jitter_seed == 0) {
+      jitter_seed = 1;
+    }
+  }
+  return rand_r(&jitter_seed) % (max_ms + 1);
+}
+
+//! Returns the milliseconds from a to b.
+static long long DiffMs(const struct timespec *a, const struct timespec *b) {
+  return (b->tv_sec - a->tv_sec) * 1000LL +
+         (b->tv_nsec - a->tv_nsec) / 1000000L;
+}
+
+void InitRestartPolicy(RestartPolicy *policy, int max_delay_ms,
+                       int give_up_after) {
+  memset(policy, 0, sizeof(*policy));
+  policy->max_delay_ms = max_delay_ms;
+  policy->give_up_after = give_up_after;
+}
+
+int MayStartChild(const RestartPolicy *policy) {
+  return !policy->gave_up && GetRestartDelayMs(policy) < 0;
+}
+
+void RecordChildStart(RestartPolicy *policy) {
+  ++policy->starts;
+  clock_gettime(CLOCK_MONOTONIC, &policy->started);
+}
+
+void RecordChildExit(RestartPolicy *policy, const char *name, int exit_status,
+                     int expected) {
+  policy->last_exit_status = exit_status;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (expected || DiffMs(&policy->started, &now) >= RESTART_HEALTHY_MS) {
+    policy->failures = 0;
+    policy->next_start = now;
+    return;
+  }
+
+  ++policy->failures;
+  if (policy->give_up_after > 0 &&
+      policy->failures >= policy->give_up_after) {
+    Log("%s failed %d times in a row (last status %d) - giving up", name,
+        policy->failures, exit_status);
+    policy->gave_up = 1;
+    return;
+  }
+
+  // Double the delay for each failure in a row.
+  long long delay_ms = RESTART_MIN_DELAY_MS;
+  for (int i = 1; i < policy->failures && delay_ms < policy->max_delay_ms;
+       ++i) {
+    delay_ms *= 2;
+  }
+  if (delay_ms > policy->max_delay_ms) {
+    delay_ms = policy->max_delay_ms;
+  }
+  // Jitter avoids several failing children restarting in lockstep.
+  long long jitter_ms = delay_ms / 4;
+  if (jitter_ms > RESTART_MAX_JITTER_MS) {
+    jitter_ms = RESTART_MAX_JITTER_MS;
+  }
+  delay_ms += RandomJitterMs(&now, jitter_ms);
+  if (policy->failures > 1) {
+    Log("%s failed %d times in a row (last status %d) - restarting in %lld ms",
+        name, policy->failures, exit_status, delay_ms);
+  }
+  policy->next_start.tv_sec = now.tv_sec + delay_ms / 1000;
+  policy->next_start.tv_nsec = now.tv_nsec + (delay_ms % 1000) * 1000000L;
+  if (policy->next_start.tv_nsec >= 1000000000L) {
+    ++policy->next_start.tv_sec;
+    policy->next_start.tv_nsec -= 1000000000L;
+  }
+}
+
+int GetRestartDelayMs(const RestartPolicy *policy) {
+  if (policy->gave_up) {
+    return -1;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long long ms = (policy->next_start.tv_sec - now.tv_sec) * 1000LL +
+                 (policy->next_start.tv_nsec - now.tv_nsec + 999999L) /
+                     1000000L;
+  if (ms <= 0) {
+    return -1;
+  }
+  return (int)ms;
+}
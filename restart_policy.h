@@ -0,0 +1,93 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef RESTART_POLICY_H
+#define RESTART_POLICY_H
+
+#include <time.h>  // for timespec
+
+//! The delay before restarting a child after its first quick failure.
+#define RESTART_MIN_DELAY_MS 100
+
+//! The maximum random delay added to each restart delay.
+#define RESTART_MAX_JITTER_MS 1000
+
+//! A child running at least this long did not fail quickly.
+#define RESTART_HEALTHY_MS 10000
+
+/*! \brief The restart state of a child process slot.
+ *
+ * A zero-initialized RestartPolicy merely keeps track of the child, but never
+ * delays restarting it; InitRestartPolicy() sets up delays.
+ */
+typedef struct {
+  //! The maximum delay between restarts, excluding jitter.
+  int max_delay_ms;
+  //! After this many quick failures in a row, never restart again (0: never
+  //! give up).
+  int give_up_after;
+  //! How often the child has been started.
+  int starts;
+  //! How often the child failed quickly in a row.
+  int failures;
+  //! The exit status of the last child, as returned by WaitPgrp(), or 0 if
+  //! none exited yet.
+  int last_exit_status;
+  //! Whether we gave up restarting the child.
+  int gave_up;
+  //! When the child was last started.
+  struct timespec started;
+  //! When the child may be started again.
+  struct timespec next_start;
+} RestartPolicy;
+
+/*! \brief Initializes the restart state of a slot.
+ *
+ * \param max_delay_ms The maximum delay between restarts, excluding jitter.
+ * \param give_up_after After this many quick failures in a row, never restart
+ *   again; zero means to never give up.
+ */
+void InitRestartPolicy(RestartPolicy *policy, int max_delay_ms,
+                       int give_up_after);
+
+/*! \brief Returns whether the child may be started now.
+ */
+int MayStartChild(const RestartPolicy *policy);
+
+/*! \brief Records that the child has been started.
+ */
+void RecordChildStart(RestartPolicy *policy);
+
+/*! \brief Records that the child has exited, or could not be started.
+ *
+ * If the child exited quickly and unexpectedly, restarting it is delayed
+ * exponentially, and eventually given up.
+ *
+ * \param name The name of the child for logging.
+ * \param exit_status The exit status as returned by WaitPgrp().
+ * \param expected Whether we asked the child to exit.
+ */
+void RecordChildExit(RestartPolicy *policy, const char *name, int exit_status,
+                     int expected);
+
+/*! \brief Returns the time until the child may be started again.
+ *
+ * \return The time in milliseconds (rounded up), or -1 if nothing needs to be
+ *   waited for, i.e. if the child may be started now or never again.
+ */
+int GetRestartDelayMs(const RestartPolicy *policy);
+
+#endif
@@ -16,27 +16,106 @@ limitations under the License.
 
 #include "saver_child.h"
 
-#include <signal.h>  // for sigemptyset, sigprocmask, SIG_SETMASK
-#include <stdlib.h>  // for NULL, EXIT_FAILURE
-#include <unistd.h>  // for pid_t, _exit, execl, fork, setsid, sleep
+#include <signal.h>    // for sig_atomic_t, SIGCONT, SIGSTOP, SIGTERM, ...
+#include <stdlib.h>    // for NULL, EXIT_FAILURE
+#include <sys/wait.h>  // for waitid, P_PID, WEXITED, WNOHANG, WNOWAIT
+#include <unistd.h>    // for pid_t
 
+#include "child_cgroup.h"      // for GetChildCgroupSetup, CHILD_CGROUP_SAVER
 #include "logging.h"           // for LogErrno, Log
-#include "wait_pgrp.h"         // for KillPgrp, WaitPgrp
-#include "xscreensaver_api.h"  // for ExportWindowID and ExportSaverIndex
+#include "restart_policy.h"    // for RecordChildExit, MayStartChild
+#include "wait_pgrp.h"         // for KillPgrp, SpawnHelper, WaitPgrp
+#include "xscreensaver_api.h"  // for FormatWindowIDEnv, FormatSaverIndexEnv
 
 //! The PIDs of currently running saver children, or 0 if not running.
 static pid_t saver_child_pid[MAX_SAVERS] = {0};
 
+//! After this many quick failures in a row, a saver child is not restarted, so
+//! the screen just stays blank.
+#define SAVER_RESTART_GIVE_UP_AFTER 10
+
+//! The maximum delay between restarts of a saver child.
+#define SAVER_RESTART_MAX_DELAY_MS 30000
+
+//! The restart state of each saver child.
+static RestartPolicy saver_restart[MAX_SAVERS];
+
+//! Whether saver_restart has been initialized.
+static int saver_restart_initialized = 0;
+
+//! Whether the saver children are currently stopped by FreezeSaverChildren().
+static volatile sig_atomic_t saver_children_frozen = 0;
+
+//! Sends a signal to the saver child at the given index.
+static void SignalSaverChild(int index, int signo) {
+  KillPgrp(saver_child_pid[index], signo);
+}
+
 void KillAllSaverChildrenSigHandler(int signo) {
   // This is a signal handler, so we're not going to make this too
   // complicated. Just kill 'em all.
   for (int i = 0; i < MAX_SAVERS; ++i) {
     if (saver_child_pid[i] != 0) {
-      KillPgrp(saver_child_pid[i], signo);
+      SignalSaverChild(i, signo);
+      if (signo == SIGTERM && saver_children_frozen) {
+        // Stopped processes only act on SIGTERM once continued.
+        SignalSaverChild(i, SIGCONT);
+      }
+    }
+  }
+}
+
+/*! \brief Reaps the saver child at the given index if it terminated.
+ *
+ * \return Whether the saver child is gone.
+ */
+static int WaitSaverChild(int index, int killed, int *status) {
+  return WaitPgrp("saver", &saver_child_pid[index], killed, killed, status);
+}
+
+//! Returns whether the saver child at the given index died, without reaping it.
+static int SaverChildExited(int index) {
+  siginfo_t info;
+  info.si_pid = 0;
+  if (waitid(P_PID, (id_t)saver_child_pid[index], &info,
+             WEXITED | WNOHANG | WNOWAIT) < 0) {
+    LogErrno("waitid");
+    return 0;
+  }
+  return info.si_pid != 0;
+}
+
+void FreezeSaverChildren(int frozen, int relay) {
+  if (!frozen == !saver_children_frozen) {
+    return;
+  }
+  saver_children_frozen = frozen;
+  for (int i = 0; i < MAX_SAVERS; ++i) {
+    if (saver_child_pid[i] != 0) {
+      SignalSaverChild(i, !frozen ? SIGCONT : relay ? SIGTSTP : SIGSTOP);
     }
   }
 }
 
+//! Returns the restart state of the saver child at the given index.
+static RestartPolicy* GetSaverRestart(int index) {
+  if (!saver_restart_initialized) {
+    for (int i = 0; i < MAX_SAVERS; ++i) {
+      InitRestartPolicy(&saver_restart[i], SAVER_RESTART_MAX_DELAY_MS,
+                        SAVER_RESTART_GIVE_UP_AFTER);
+    }
+    saver_restart_initialized = 1;
+  }
+  return &saver_restart[index];
+}
+
+const RestartPolicy* GetSaverChildRestartPolicy(int index) {
+  if (index < 0 || index >= MAX_SAVERS) {
+    return NULL;
+  }
+  return GetSaverRestart(index);
+}
+
 void WatchSaverChild(Display* dpy, Window w, int index, const char* executable,
                      int should_be_running) {
   if (index < 0 || index >= MAX_SAVERS) {
@@ -44,41 +123,48 @@ void WatchSaverChild(Display* dpy, Window w, int index, const char* executable,
     return;
   }
 
+  RestartPolicy* restart = GetSaverRestart(index);
+
   if (saver_child_pid[index] != 0) {
     if (!should_be_running) {
-      KillPgrp(saver_child_pid[index], SIGTERM);
+      SignalSaverChild(index, SIGTERM);
+      if (saver_children_frozen) {
+        // Stopped processes only act on SIGTERM once continued.
+        SignalSaverChild(index, SIGCONT);
+      }
+    } else if (saver_children_frozen && SaverChildExited(index)) {
+      // Killed while stopped (e.g. by the OOM killer). The rest of its process
+      // group must be continued to act on the SIGTERM sent when reaping it.
+      SignalSaverChild(index, SIGCONT);
     }
 
     int status;
-    if (WaitPgrp("saver", &saver_child_pid[index], !should_be_running,
-                 !should_be_running, &status)) {
+    if (WaitSaverChild(index, !should_be_running, &status)) {
       // Now is the time to remove anything the child may have displayed.
       XClearWindow(dpy, w);
+      RecordChildExit(restart, "Saver", status, !should_be_running);
     }
   }
 
-  if (should_be_running && saver_child_pid[index] == 0) {
-    pid_t pid = ForkWithoutSigHandlers();
-    if (pid == -1) {
-      LogErrno("fork");
-    } else if (pid == 0) {
-      // Child process.
-      StartPgrp();
-      ExportWindowID(w);
-      ExportSaverIndex(index);
-
-      {
-        const char* args[3] = {
-            executable,
-            "-root",  // For XScreenSaver hacks, unused by our own.
-            NULL};
-        ExecvHelper(executable, args);
-        sleep(2);  // Reduce log spam or other effects from failed execv.
-        _exit(EXIT_FAILURE);
-      }
-    } else {
-      // Parent process after successful fork.
+  // Frozen saver children are not restarted until thawed.
+  if (should_be_running && !saver_children_frozen &&
+      saver_child_pid[index] == 0 && MayStartChild(restart)) {
+    char window_env[XSCREENSAVER_ENV_SIZE], index_env[XSCREENSAVER_ENV_SIZE];
+    FormatWindowIDEnv(window_env, w);
+    FormatSaverIndexEnv(index_env, index);
+    const char* env[3] = {window_env, index_env, NULL};
+    const char* args[3] = {
+        executable,
+        "-root",  // For XScreenSaver hacks, unused by our own.
+        NULL};
+    SpawnOptions options = {-1, -1, 1, env,
+                            GetChildCgroupSetup(CHILD_CGROUP_SAVER)};
+    pid_t pid = SpawnHelper(executable, args, &options);
+    RecordChildStart(restart);
+    if (pid != -1) {
       saver_child_pid[index] = pid;
+    } else {
+      RecordChildExit(restart, "Saver", EXIT_FAILURE, 0);
     }
   }
 }
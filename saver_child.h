@@ -20,6 +20,8 @@ limitations under the License.
 #include <X11/X.h>     // for Window
 #include <X11/Xlib.h>  // for Display
 
+#include "restart_policy.h"  // for RestartPolicy
+
 #define MAX_SAVERS 16
 
 /*! \brief Kill all saver children.
@@ -42,4 +44,35 @@ void KillAllSaverChildrenSigHandler(int signo);
 void WatchSaverChild(Display* dpy, Window w, int index, const char* executable,
                      int should_be_running);
 
+/*! \brief Returns the restart state of a saver child.
+ *
+ * Saver children that keep failing right after starting are restarted with
+ * increasing delays, and eventually not at all, leaving the screen blank.
+ *
+ * \param index The index of the saver (0 <= index < MAX_SAVERS).
+ * \return The restart state, or NULL if index is out of range.
+ */
+const RestartPolicy* GetSaverChildRestartPolicy(int index);
+
+/*! \brief Freezes or thaws all running saver children.
+ *
+ * Frozen saver children are stopped using SIGSTOP, so they use no CPU, and
+ * continue where they left off once thawed using SIGCONT. Saver children killed
+ * by WatchSaverChild() or KillAllSaverChildrenSigHandler() are thawed as
+ * needed.
+ *
+ * As each saver child runs in a process group of its own, a saver child that
+ * spawns savers itself (such as saver_multiplex) must freeze them before it
+ * gets stopped. Such children are sent SIGTSTP instead, upon which they freeze
+ * their own saver children and then stop themselves using SIGSTOP.
+ *
+ * While frozen, WatchSaverChild() still reaps saver children that died or
+ * terminates them, but does not start any.
+ *
+ * \param frozen If true, the saver children are frozen; if false, thawed.
+ * \param relay If true, the saver children are frozen using SIGTSTP rather
+ *   than SIGSTOP.
+ */
+void FreezeSaverChildren(int frozen, int relay);
+
 #endif
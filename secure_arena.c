@@ -0,0 +1,205 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// For MAP_ANONYMOUS, MADV_DONTDUMP and MADV_WIPEONFORK.
+#define _GNU_SOURCE
+
+#include "secure_arena.h"
+
+#include <stdint.h>    // for uintptr_t
+#include <sys/mman.h>  // for mmap, munmap, mprotect, madvise, MAP_ANONYMOUS
+#include <unistd.h>    // for sysconf, _SC_PAGESIZE
+
+#include "logging.h"     // for LogErrno
+#include "mlock_page.h"  // for MLOCK_PAGE
+#include "util.h"        // for explicit_bzero
+
+//! The alignment of all allocations.
+#define SECURE_ARENA_ALIGN 16
+
+//! Rounds n up to a multiple of the power of two a.
+#define ALIGN_UP(n, a) (((n) + (a)-1) & ~((size_t)(a)-1))
+
+//! The header preceding each allocation.
+typedef struct {
+  //! The size of the payload following the header.
+  size_t size;
+  //! Whether the block is allocated.
+  size_t in_use;
+  //! For blocks mapped outside the arena, the number of bytes locked.
+  size_t locked;
+} BlockHeader;
+
+//! The size of BlockHeader, keeping the payload aligned.
+#define HEADER_SIZE ALIGN_UP(sizeof(BlockHeader), SECURE_ARENA_ALIGN)
+
+//! The usable part of the arena (between the guard pages), or NULL.
+static char *arena = NULL;
+
+//! The size of the usable part of the arena.
+static size_t arena_size = 0;
+
+//! The bytes of the arena currently in use, including headers.
+static size_t arena_used = 0;
+
+//! The maximum of arena_used so far.
+static size_t arena_peak = 0;
+
+//! The bytes currently locked outside the arena by SecureAlloc().
+static size_t mapped_locked = 0;
+
+//! Whether the arena is locked to RAM.
+static int arena_locked = 0;
+
+int InitSecureArena(size_t size) {
+  if (arena != NULL) {
+    return arena_locked ? 0 : -1;
+  }
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size = ALIGN_UP(size, page);
+  char *mapping = mmap(NULL, size + 2 * page, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    LogErrno("mmap");
+    return -1;
+  }
+  // The first and last page stay inaccessible, to catch overflows.
+  if (mprotect(mapping + page, size, PROT_READ | PROT_WRITE)) {
+    LogErrno("mprotect");
+    munmap(mapping, size + 2 * page);
+    return -1;
+  }
+  arena = mapping + page;
+  arena_size = size;
+#ifdef MADV_DONTDUMP
+  if (madvise(arena, arena_size, MADV_DONTDUMP)) {
+    LogErrno("madvise(MADV_DONTDUMP)");
+  }
+#endif
+#ifdef MADV_WIPEONFORK
+  // Forked children never need our secrets. Note that this is Linux 4.14+.
+  (void)madvise(arena, arena_size, MADV_WIPEONFORK);
+#endif
+  arena_locked = MLOCK_PAGE(arena, arena_size) == 0;
+  if (!arena_locked) {
+    LogErrno("mlock");
+  }
+
+  BlockHeader *block = (BlockHeader *)arena;
+  block->size = arena_size - HEADER_SIZE;
+  block->in_use = 0;
+  block->locked = 0;
+  return arena_locked ? 0 : -1;
+}
+
+//! Returns the header of the block following the given one, or NULL.
+static BlockHeader *NextBlock(BlockHeader *block) {
+  char *next = (char *)block + HEADER_SIZE + block->size;
+  return next < arena + arena_size ? (BlockHeader *)next : NULL;
+}
+
+//! Returns whether ptr points into the arena.
+static int InArena(const void *ptr) {
+  return arena != NULL && (uintptr_t)ptr >= (uintptr_t)arena &&
+         (uintptr_t)ptr < (uintptr_t)(arena + arena_size);
+}
+
+void *SecureAlloc(size_t size) {
+  size = ALIGN_UP(size ? size : 1, SECURE_ARENA_ALIGN);
+  for (BlockHeader *block = arena != NULL ? (BlockHeader *)arena : NULL;
+       block != NULL; block = NextBlock(block)) {
+    if (block->in_use || block->size < size) {
+      continue;
+    }
+    // Split off the remainder if it can hold another allocation.
+    if (block->size >= size + HEADER_SIZE + SECURE_ARENA_ALIGN) {
+      BlockHeader *rest = (BlockHeader *)((char *)block + HEADER_SIZE + size);
+      rest->size = block->size - size - HEADER_SIZE;
+      rest->in_use = 0;
+      rest->locked = 0;
+      block->size = size;
+    }
+    block->in_use = 1;
+    arena_used += HEADER_SIZE + block->size;
+    if (arena_used > arena_peak) {
+      arena_peak = arena_used;
+    }
+    // Free blocks are always wiped, so no need to clear it here.
+    return (char *)block + HEADER_SIZE;
+  }
+
+  // Arena full: fall back to a mapping of its own, so no other data shares
+  // its locked pages and they can be unlocked again when freed.
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t mapping_size = ALIGN_UP(HEADER_SIZE + size, page);
+  BlockHeader *block = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (block == MAP_FAILED) {
+    LogErrno("mmap");
+    return NULL;
+  }
+#ifdef MADV_DONTDUMP
+  (void)madvise(block, mapping_size, MADV_DONTDUMP);
+#endif
+  block->size = mapping_size - HEADER_SIZE;
+  block->in_use = 1;
+  block->locked = 0;
+  if (MLOCK_PAGE(block, mapping_size) < 0) {
+    // We continue anyway, as the user being unable to unlock the screen is
+    // worse.
+    LogErrno("mlock");
+  } else {
+    block->locked = mapping_size;
+    mapped_locked += mapping_size;
+  }
+  return (char *)block + HEADER_SIZE;
+}
+
+void SecureFree(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  BlockHeader *block = (BlockHeader *)((char *)ptr - HEADER_SIZE);
+  explicit_bzero(ptr, block->size);
+  if (!InArena(ptr)) {
+    // Unmapping also unlocks the pages.
+    mapped_locked -= block->locked;
+    munmap(block, HEADER_SIZE + block->size);
+    return;
+  }
+  block->in_use = 0;
+  arena_used -= HEADER_SIZE + block->size;
+  // Merge adjacent free blocks; the arena is small, so just do all of them.
+  for (BlockHeader *b = (BlockHeader *)arena; b != NULL; b = NextBlock(b)) {
+    BlockHeader *next;
+    while (!b->in_use && (next = NextBlock(b)) != NULL && !next->in_use) {
+      b->size += HEADER_SIZE + next->size;
+      explicit_bzero(next, HEADER_SIZE);
+    }
+  }
+}
+
+void WipeSecureArenaSigHandler(void) {
+  if (arena != NULL) {
+    explicit_bzero(arena, arena_size);
+  }
+}
+
+size_t GetSecureArenaLockedBytes(void) {
+  return (arena_locked ? arena_size : 0) + mapped_locked;
+}
+
+size_t GetSecureArenaPeakBytes(void) { return arena_peak; }
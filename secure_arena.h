@@ -0,0 +1,71 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SECURE_ARENA_H
+#define SECURE_ARENA_H
+
+#include <stddef.h>  // for size_t
+
+//! The default size of the secure arena; enough for all our secrets.
+#define SECURE_ARENA_SIZE 32768
+
+/*! \brief Sets up the secure arena for secrets, such as passwords.
+ *
+ * The arena is a single memory mapping that is locked to RAM using mlock() to
+ * avoid leakage to disk via swap, excluded from core dumps, surrounded by
+ * guard pages, and (where supported) not inherited by forked children.
+ *
+ * \param size The size of the arena in bytes; rounded up to whole pages.
+ * \return Zero if the arena has been set up and locked. Otherwise, allocations
+ *   will still work, but may not be protected.
+ */
+int InitSecureArena(size_t size);
+
+/*! \brief Allocates zeroed memory for secrets.
+ *
+ * If the arena is full or has not been set up, the memory is mapped and locked
+ * separately, rounded up to whole pages.
+ *
+ * \param size The number of bytes to allocate.
+ * \return The memory, or NULL if out of memory.
+ */
+void *SecureAlloc(size_t size);
+
+/*! \brief Wipes and frees memory returned by SecureAlloc().
+ *
+ * \param ptr The memory to free; NULL is permitted.
+ */
+void SecureFree(void *ptr);
+
+/*! \brief Wipes the whole secure arena.
+ *
+ * This can be used from a signal handler, right before exiting. Memory
+ * mapped outside the arena by SecureAlloc() is not wiped.
+ */
+void WipeSecureArenaSigHandler(void);
+
+/*! \brief Returns how many bytes of memory are currently locked for secrets.
+ *
+ * This includes both the arena and memory SecureAlloc() had to map outside of
+ * it and which was not freed yet.
+ */
+size_t GetSecureArenaLockedBytes(void);
+
+/*! \brief Returns how many bytes of the arena were in use at most.
+ */
+size_t GetSecureArenaPeakBytes(void);
+
+#endif
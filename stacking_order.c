@@ -0,0 +1,234 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "stacking_order.h"
+
+#include <X11/X.h>     // for Window, None, PlaceOnTop
+#include <X11/Xlib.h>  // for XQueryTree, XFree, XEvent
+#include <stdlib.h>    // for free, realloc
+#include <string.h>    // for memcpy, memmove
+
+#include "logging.h"  // for Log
+
+/*! \brief How often to refetch the stacking order even if it appears valid.
+ *
+ * The model should never diverge from the server state, but if it does, this
+ * bounds how long we act on wrong information.
+ */
+#define STACKING_ORDER_RESYNC_SEC 10
+
+void InitStackingOrder(StackingOrder *order, Display *display, Window parent) {
+  order->display = display;
+  order->parent = parent;
+  order->windows = NULL;
+  order->n_windows = 0;
+  order->capacity = 0;
+  order->valid = 0;
+  order->last_sync.tv_sec = 0;
+  order->last_sync.tv_nsec = 0;
+}
+
+void InvalidateStackingOrder(StackingOrder *order) { order->valid = 0; }
+
+static int Reserve(StackingOrder *order, unsigned int n) {
+  if (n <= order->capacity) {
+    return 1;
+  }
+  unsigned int capacity = order->capacity ? order->capacity : 16;
+  while (capacity < n) {
+    capacity *= 2;
+  }
+  Window *windows = realloc(order->windows, capacity * sizeof(*windows));
+  if (windows == NULL) {
+    Log("Out of memory tracking the stacking order");
+    return 0;
+  }
+  order->windows = windows;
+  order->capacity = capacity;
+  return 1;
+}
+
+static void Resync(StackingOrder *order) {
+  Window unused_root, unused_parent;
+  Window *children;
+  unsigned int n_children;
+  order->n_windows = 0;
+  order->valid = 0;
+  clock_gettime(CLOCK_MONOTONIC, &order->last_sync);
+  if (!XQueryTree(order->display, order->parent, &unused_root, &unused_parent,
+                  &children, &n_children)) {
+    Log("XQueryTree failed");
+    return;
+  }
+  if (Reserve(order, n_children)) {
+    if (n_children != 0) {
+      memcpy(order->windows, children, n_children * sizeof(*children));
+    }
+    order->n_windows = n_children;
+    order->valid = 1;
+  }
+  XFree(children);
+}
+
+//! Returns the index of w, or n_windows if not found.
+static unsigned int Find(const StackingOrder *order, Window w) {
+  // Search from the top, as that is where changes usually happen.
+  for (unsigned int i = order->n_windows; i > 0; --i) {
+    if (order->windows[i - 1] == w) {
+      return i - 1;
+    }
+  }
+  return order->n_windows;
+}
+
+static void Remove(StackingOrder *order, Window w) {
+  unsigned int i = Find(order, w);
+  if (i == order->n_windows) {
+    // May happen for events that were queued before the last resync.
+    return;
+  }
+  memmove(&order->windows[i], &order->windows[i + 1],
+          (order->n_windows - i - 1) * sizeof(*order->windows));
+  --order->n_windows;
+}
+
+//! Places w directly above the window below, or at the bottom if None.
+static void PlaceAbove(StackingOrder *order, Window w, Window below) {
+  Remove(order, w);
+  unsigned int pos = 0;
+  if (below != None) {
+    pos = Find(order, below);
+    if (pos == order->n_windows) {
+      InvalidateStackingOrder(order);
+      return;
+    }
+    ++pos;
+  }
+  if (!Reserve(order, order->n_windows + 1)) {
+    InvalidateStackingOrder(order);
+    return;
+  }
+  memmove(&order->windows[pos + 1], &order->windows[pos],
+          (order->n_windows - pos) * sizeof(*order->windows));
+  order->windows[pos] = w;
+  ++order->n_windows;
+}
+
+static void PlaceOnTopOf(StackingOrder *order, Window w) {
+  Remove(order, w);
+  PlaceAbove(order, w,
+             order->n_windows ? order->windows[order->n_windows - 1] : None);
+}
+
+//! Applies a change from an event about the child window w to the model.
+static void Apply(StackingOrder *order, const XEvent *ev, Window w) {
+  switch (ev->type) {
+    case CreateNotify:
+      // New windows are created on top of their siblings.
+      PlaceOnTopOf(order, w);
+      break;
+    case DestroyNotify:
+      Remove(order, w);
+      break;
+    case ReparentNotify:
+      // Reparented windows are placed on top of their new siblings.
+      if (ev->xreparent.parent == order->parent) {
+        PlaceOnTopOf(order, w);
+      } else {
+        Remove(order, w);
+      }
+      break;
+    case ConfigureNotify:
+      PlaceAbove(order, w, ev->xconfigure.above);
+      break;
+    case CirculateNotify:
+      if (ev->xcirculate.place == PlaceOnTop) {
+        PlaceOnTopOf(order, w);
+      } else {
+        PlaceAbove(order, w, None);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+int UpdateStackingOrder(StackingOrder *order, const XEvent *ev) {
+  Window w;
+  switch (ev->type) {
+    case CreateNotify:
+      w = ev->xcreatewindow.window;
+      break;
+    case DestroyNotify:
+      w = ev->xdestroywindow.window;
+      break;
+    case ReparentNotify:
+      w = ev->xreparent.window;
+      break;
+    case ConfigureNotify:
+      w = ev->xconfigure.window;
+      break;
+    case CirculateNotify:
+      w = ev->xcirculate.window;
+      break;
+    case MapNotify:
+      w = ev->xmap.window;
+      break;
+    case UnmapNotify:
+      w = ev->xunmap.window;
+      break;
+    case GravityNotify:
+      w = ev->xgravity.window;
+      break;
+    default:
+      return 0;
+  }
+  if (ev->xany.window != order->parent || w == order->parent) {
+    // A StructureNotify event. If it is about one of the children, apply it
+    // right away anyway, as it may be processed before the SubstructureNotify
+    // copy; applying it twice does no harm.
+    if ((ev->type == ConfigureNotify || ev->type == CirculateNotify) &&
+        order->valid && Find(order, w) != order->n_windows) {
+      Apply(order, ev, w);
+    }
+    return 0;
+  }
+  if (order->valid) {
+    Apply(order, ev, w);
+  }
+  return 1;
+}
+
+Window GetTopmostWindow(StackingOrder *order) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!order->valid ||
+      now.tv_sec - order->last_sync.tv_sec >= STACKING_ORDER_RESYNC_SEC) {
+    Resync(order);
+  }
+  if (order->n_windows == 0) {
+    return None;
+  }
+  return order->windows[order->n_windows - 1];
+}
+
+void ClearStackingOrder(StackingOrder *order) {
+  free(order->windows);
+  order->windows = NULL;
+  order->n_windows = 0;
+  order->capacity = 0;
+  order->valid = 0;
+}
@@ -0,0 +1,78 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef STACKING_ORDER_H
+#define STACKING_ORDER_H
+
+#include <X11/X.h>     // for Window
+#include <X11/Xlib.h>  // for Display, XEvent
+#include <time.h>      // for timespec
+
+/*! \brief A model of the stacking order of the children of a window.
+ *
+ * The model is kept up to date from SubstructureNotify events, so that finding
+ * the topmost child needs no round trip to the X server. The caller must
+ * select SubstructureNotifyMask on the parent window.
+ */
+typedef struct {
+  //! The X11 display.
+  Display *display;
+  //! The window whose children are tracked.
+  Window parent;
+  //! The children of parent, bottom to top.
+  Window *windows;
+  //! The number of children in windows.
+  unsigned int n_windows;
+  //! The number of children windows has room for.
+  unsigned int capacity;
+  //! Whether the model is believed to match the server state.
+  int valid;
+  //! When the model was last fetched from the server (CLOCK_MONOTONIC).
+  struct timespec last_sync;
+} StackingOrder;
+
+/*! \brief Initializes the stacking order model.
+ *
+ * The model is fetched from the X server on first use.
+ */
+void InitStackingOrder(StackingOrder *order, Display *display, Window parent);
+
+/*! \brief Updates the stacking order model from an X11 event.
+ *
+ * \return Nonzero if the event is a SubstructureNotify event of the parent
+ *   window. Such events are duplicates of StructureNotify events for windows
+ *   that also select those, and thus should not be processed any further.
+ */
+int UpdateStackingOrder(StackingOrder *order, const XEvent *ev);
+
+/*! \brief Marks the model as outdated, so it gets fetched again on next use.
+ */
+void InvalidateStackingOrder(StackingOrder *order);
+
+/*! \brief Returns the topmost child window.
+ *
+ * Refetches the model from the server if it is known to be outdated, and
+ * periodically just in case.
+ *
+ * \return The topmost child window, or None if there are no children.
+ */
+Window GetTopmostWindow(StackingOrder *order);
+
+/*! \brief Clears the stacking order model when done.
+ */
+void ClearStackingOrder(StackingOrder *order);
+
+#endif
@@ -0,0 +1,107 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ *\brief Counts the syscalls authproto needs per packet.
+ *
+ * Usage: authproto_bench [iterations]
+ *
+ * Sends password-like packets through a pipe using WritePacket() and
+ * ReadPacket(), and prints the number of read, write and writev calls per
+ * packet, as well as the time per round trip.
+ *
+ * Must be linked with -Wl,--wrap=read,--wrap=write,--wrap=writev so that the
+ * calls made by authproto.c end up in the counting wrappers below.
+ */
+
+#include <stdio.h>    // for printf, fprintf
+#include <stdlib.h>   // for atoi, free, EXIT_FAILURE
+#include <string.h>   // for strcmp
+#include <sys/uio.h>  // for iovec
+#include <time.h>     // for clock_gettime
+#include <unistd.h>   // for pipe, ssize_t
+
+#include "../helpers/authproto.h"  // for WritePacket, ReadPacket
+#include "../secure_arena.h"       // for InitSecureArena
+
+//! The number of calls, per function.
+static long reads, writes, writevs;
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+ssize_t __real_writev(int fd, const struct iovec *iov, int iovcnt);
+
+ssize_t __wrap_read(int fd, void *buf, size_t count) {
+  ++reads;
+  return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+  ++writes;
+  return __real_write(fd, buf, count);
+}
+
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int iovcnt) {
+  ++writevs;
+  return __real_writev(fd, iov, iovcnt);
+}
+
+static double NowUs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+  if (iterations <= 0) {
+    fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  InitSecureArena(SECURE_ARENA_SIZE);
+
+  int fds[2];
+  if (pipe(fds)) {
+    perror("pipe");
+    return EXIT_FAILURE;
+  }
+  // Both a lone packet, and two packets that are read back to back.
+  const char *password = "correct horse battery staple";
+  double t0 = NowUs();
+  for (int i = 0; i < iterations; ++i) {
+    WritePacket(fds[1], PTYPE_RESPONSE_LIKE_PASSWORD, password);
+    if (i % 2 == 0) {
+      WritePacket(fds[1], PTYPE_RESPONSE_LIKE_PASSWORD, password);
+    }
+    for (int j = 0; j < (i % 2 == 0 ? 2 : 1); ++j) {
+      char *message;
+      if (ReadPacket(fds[0], &message, 0) != PTYPE_RESPONSE_LIKE_PASSWORD ||
+          strcmp(message, password)) {
+        fprintf(stderr, "Packet did not survive the round trip\n");
+        return EXIT_FAILURE;
+      }
+      free(message);
+    }
+  }
+  double elapsed = NowUs() - t0;
+
+  double packets = iterations + (iterations + 1) / 2;
+  printf("authproto: %.2f reads, %.2f writes, %.2f writevs per packet, "
+         "%.2f us per packet (n=%.0f)\n",
+         reads / packets, writes / packets, writevs / packets,
+         elapsed / packets, packets);
+  return 0;
+}
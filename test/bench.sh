@@ -0,0 +1,103 @@
+#!/bin/bash
+#
+# Copyright 2018 Google Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Benchmarks lock, wake and unlock latency of xsecurelock on a private Xvfb.
+#
+# Usually run via "make bench". Usage:
+#
+#   BUILDDIR=... SRCDIR=... HELPERDIR=... test/bench.sh [iterations]
+#
+# Requires Xvfb. The binaries benchmarked are taken from the build tree, but
+# they still run in the configured helper directory HELPERDIR and may need the
+# pgrp_placeholder helper from there. So run "make install" first (possibly
+# into a scratch --prefix).
+#
+# Additional XSECURELOCK_* settings can be passed in the environment, e.g. to
+# compare XSECURELOCK_AUTH_WARM_STANDBY=0 and 1.
+
+set -e
+
+builddir=${BUILDDIR:-.}
+srcdir=${SRCDIR:-$(dirname "$0")/..}
+iterations=${1:-${BENCH_ITERATIONS:-20}}
+password=benchpassword
+
+if [ -n "$HELPERDIR" ] && ! [ -x "$HELPERDIR/pgrp_placeholder" ]; then
+	echo >&2 "$HELPERDIR/pgrp_placeholder not found; run \"make install\" first."
+	exit 1
+fi
+
+tmp=$(mktemp -d)
+xvfb_pid=
+cleanup() {
+	if [ -n "$xvfb_pid" ]; then
+		kill "$xvfb_pid" 2>/dev/null || true
+		wait "$xvfb_pid" 2>/dev/null || true
+	fi
+	rm -rf "$tmp"
+}
+trap cleanup EXIT
+
+# Start a private X server; it tells us its display number when ready.
+Xvfb -displayfd 3 -screen 0 1280x800x24 -nolisten tcp \
+	3>"$tmp/display" 2>"$tmp/xvfb.log" &
+xvfb_pid=$!
+for _ in $(seq 100); do
+	[ -s "$tmp/display" ] && break
+	sleep 0.1
+done
+if ! [ -s "$tmp/display" ]; then
+	echo >&2 "Xvfb did not start:"
+	cat >&2 "$tmp/xvfb.log"
+	exit 1
+fi
+export DISPLAY=:$(cat "$tmp/display")
+
+export BENCH_PASSWORD=$password
+export XSECURELOCK_AUTH="$builddir/auth_x11"
+export XSECURELOCK_AUTHPROTO="$(cd "$srcdir" && pwd)/test/bench_authproto.sh"
+export XSECURELOCK_GLOBAL_SAVER="$(cd "$srcdir" && pwd)/helpers/saver_blank"
+export XSECURELOCK_AUTH_SOUNDS=0
+export XSECURELOCK_BLANK_TIMEOUT=-1
+unset XSS_SLEEP_LOCK_FD
+
+for i in $(seq "$iterations"); do
+	if ! "$builddir/bench_driver" "$password" "$builddir/xsecurelock" \
+		>>"$tmp/results" 2>"$tmp/driver.log"; then
+		echo >&2 "Iteration $i failed:"
+		cat >&2 "$tmp/driver.log"
+		exit 1
+	fi
+done
+
+# Prints nearest-rank percentiles of the given key from the results.
+summarize() {
+	tr ' ' '\n' <"$tmp/results" | sed -n "s/^$1=//p" | sort -n | awk -v key="$1" '
+		function rank(p,   i) {
+			i = int(p * NR)
+			if (i < p * NR) i++
+			return v[i < 1 ? 1 : i]
+		}
+		{ v[NR] = $1 }
+		END {
+			printf "%-10s p50=%8.1f ms  p95=%8.1f ms  p99=%8.1f ms  (n=%d)\n",
+				key, rank(0.5), rank(0.95), rank(0.99), NR
+		}'
+}
+
+summarize locked_ms
+summarize prompt_ms
+summarize unlock_ms
@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# Copyright 2018 Google Inc. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Stand-in authproto module for benchmarking: asks for a password once and
+# accepts exactly $BENCH_PASSWORD. Does not involve PAM at all.
+
+prompt='Password:'
+printf 'P %d\n%s\n' "${#prompt}" "$prompt"
+
+read -r type len || exit 1
+[ "$type" = p ] || exit 1
+IFS= read -r response || exit 1
+
+if [ "$response" = "$BENCH_PASSWORD" ]; then
+	exit 0
+fi
+message='Wrong password.'
+printf 'e %d\n%s\n' "${#message}" "$message"
+exit 1
@@ -0,0 +1,212 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ *\brief Runs one lock, wake and unlock cycle of xsecurelock and times it.
+ *
+ * Usage: bench_driver password /path/to/xsecurelock
+ *
+ * Prints a single line "locked_ms=... prompt_ms=... unlock_ms=..." on success,
+ * where:
+ *
+ * - locked_ms is the time from starting xsecurelock until it runs its notify
+ *   command (i.e. considers the screen locked).
+ * - prompt_ms is the time from the wake-up key press until the auth window is
+ *   mapped.
+ * - unlock_ms is the time from pressing Enter after the password until
+ *   xsecurelock exits.
+ *
+ * The auth window is found by its WM_CLASS; the key presses are injected using
+ * the XTest extension.
+ */
+
+#include <X11/Xlib.h>                // for XOpenDisplay, XNextEvent, ...
+#include <X11/Xutil.h>               // for XClassHint, XGetClassHint
+#include <X11/extensions/XTest.h>    // for XTestFakeKeyEvent
+#include <X11/keysym.h>              // for XK_space, XK_Return
+#include <errno.h>                   // for errno, EINTR
+#include <poll.h>                    // for poll, pollfd, POLLIN
+#include <signal.h>                  // for kill, SIGTERM
+#include <stdio.h>                   // for printf, fprintf, snprintf
+#include <stdlib.h>                  // for EXIT_FAILURE, EXIT_SUCCESS
+#include <string.h>                  // for strcmp
+#include <sys/wait.h>                // for waitpid, WNOHANG
+#include <time.h>                    // for clock_gettime, nanosleep
+#include <unistd.h>                  // for fork, pipe, execv, _exit
+
+//! How long to wait for each step before giving up.
+#define STEP_TIMEOUT_MS 10000
+
+static double NowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+//! Finds the window xsecurelock created with the given WM_CLASS name.
+static Window FindWindowByClass(Display *dpy, Window w, const char *res_name) {
+  XClassHint hint;
+  if (XGetClassHint(dpy, w, &hint)) {
+    int match = hint.res_name != NULL && !strcmp(hint.res_name, res_name) &&
+                hint.res_class != NULL &&
+                !strcmp(hint.res_class, "xsecurelock");
+    XFree(hint.res_name);
+    XFree(hint.res_class);
+    if (match) {
+      return w;
+    }
+  }
+  Window unused_root, unused_parent, *children = NULL;
+  unsigned int nchildren = 0;
+  if (!XQueryTree(dpy, w, &unused_root, &unused_parent, &children,
+                  &nchildren)) {
+    return None;
+  }
+  Window found = None;
+  for (unsigned int i = 0; i < nchildren && found == None; ++i) {
+    found = FindWindowByClass(dpy, children[i], res_name);
+  }
+  XFree(children);
+  return found;
+}
+
+static void PressKey(Display *dpy, KeySym sym) {
+  KeyCode code = XKeysymToKeycode(dpy, sym);
+  if (code == 0) {
+    fprintf(stderr, "No keycode for keysym %lu\n", (unsigned long)sym);
+    return;
+  }
+  XTestFakeKeyEvent(dpy, code, True, CurrentTime);
+  XTestFakeKeyEvent(dpy, code, False, CurrentTime);
+}
+
+static void Fail(const char *what, pid_t pid) {
+  fprintf(stderr, "bench_driver: %s\n", what);
+  if (pid > 0) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+  }
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s password /path/to/xsecurelock\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char *password = argv[1];
+
+  Display *dpy = XOpenDisplay(NULL);
+  if (dpy == NULL) {
+    Fail("could not connect to $DISPLAY", 0);
+  }
+  int xtest_event_base, xtest_error_base, xtest_major, xtest_minor;
+  if (!XTestQueryExtension(dpy, &xtest_event_base, &xtest_error_base,
+                           &xtest_major, &xtest_minor)) {
+    Fail("no XTest extension", 0);
+  }
+
+  // The notify command reports back via this pipe once the screen is locked.
+  int notify_pipe[2];
+  if (pipe(notify_pipe)) {
+    Fail("pipe failed", 0);
+  }
+  char notify_script[64];
+  snprintf(notify_script, sizeof(notify_script), "echo locked >&%d",
+           notify_pipe[1]);
+
+  double start_ms = NowMs();
+  pid_t pid = fork();
+  if (pid == -1) {
+    Fail("fork failed", 0);
+  }
+  if (pid == 0) {
+    close(notify_pipe[0]);
+    close(ConnectionNumber(dpy));
+    char *const args[] = {argv[2], "--", "/bin/sh", "-c", notify_script, NULL};
+    execv(argv[2], args);
+    _exit(EXIT_FAILURE);
+  }
+  close(notify_pipe[1]);
+
+  // Time to locked.
+  struct pollfd pfd;
+  pfd.fd = notify_pipe[0];
+  pfd.events = POLLIN;
+  int ret;
+  while ((ret = poll(&pfd, 1, STEP_TIMEOUT_MS)) < 0 && errno == EINTR) {
+  }
+  if (ret <= 0) {
+    Fail("timed out waiting for the screen to lock", pid);
+  }
+  double locked_ms = NowMs();
+  close(notify_pipe[0]);
+
+  // Time from key press to prompt.
+  Window auth_window = FindWindowByClass(dpy, DefaultRootWindow(dpy), "auth");
+  if (auth_window == None) {
+    Fail("could not find the auth window", pid);
+  }
+  XSelectInput(dpy, auth_window, StructureNotifyMask);
+  XSync(dpy, False);
+  double wake_ms = NowMs();
+  PressKey(dpy, XK_space);
+  XFlush(dpy);
+  double prompt_ms = 0;
+  while (prompt_ms == 0) {
+    if (!XPending(dpy)) {
+      pfd.fd = ConnectionNumber(dpy);
+      pfd.events = POLLIN;
+      ret = poll(&pfd, 1, STEP_TIMEOUT_MS);
+      if (ret < 0 && errno == EINTR) {
+        continue;
+      }
+      if (ret <= 0) {
+        Fail("timed out waiting for the auth window", pid);
+      }
+    }
+    XEvent ev;
+    XNextEvent(dpy, &ev);
+    if (ev.type == MapNotify && ev.xmap.window == auth_window) {
+      prompt_ms = NowMs();
+    }
+  }
+
+  // Time from Enter to exit.
+  for (const char *p = password; *p; ++p) {
+    char name[2] = {*p, 0};
+    PressKey(dpy, XStringToKeysym(name));
+  }
+  PressKey(dpy, XK_Return);
+  XFlush(dpy);
+  double enter_ms = NowMs();
+  int status;
+  while (waitpid(pid, &status, WNOHANG) == 0) {
+    if (NowMs() - enter_ms > STEP_TIMEOUT_MS) {
+      Fail("timed out waiting for xsecurelock to exit", pid);
+    }
+    nanosleep(&(const struct timespec){0, 100000L}, NULL);
+  }
+  double exit_ms = NowMs();
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    Fail("xsecurelock did not exit successfully", 0);
+  }
+
+  printf("locked_ms=%.3f prompt_ms=%.3f unlock_ms=%.3f\n",
+         locked_ms - start_ms, prompt_ms - wake_ms, exit_ms - enter_ms);
+  XCloseDisplay(dpy);
+  return EXIT_SUCCESS;
+}
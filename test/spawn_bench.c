@@ -0,0 +1,126 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*!
+ *\brief Compares the cost of starting a helper via fork() and SpawnHelper().
+ *
+ * Usage: spawn_bench [iterations [resident_mib]]
+ *
+ * Allocates, touches and mlocks resident_mib MiB of memory (like xsecurelock's
+ * locked pages, only more of them, to make page table copying visible), then
+ * starts /bin/true in a new process group the given number of times using
+ * each method, and prints percentiles of the time until the child is started
+ * (i.e. until the spawning call returned in the parent).
+ */
+
+#include <stdio.h>     // for printf, fprintf
+#include <stdlib.h>    // for atoi, malloc, qsort, EXIT_FAILURE
+#include <string.h>    // for memset
+#include <sys/mman.h>  // for mlock
+#include <time.h>      // for clock_gettime
+#include <unistd.h>    // for _exit
+
+#include "../wait_pgrp.h"    // for SpawnHelper, ForkWithoutSigHandlers, ...
+#include "../wakeup_pipe.h"  // for InitWakeupPipe
+
+static double NowUs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+//! Starts /bin/true the way helpers used to be started.
+static pid_t ForkTrue(void) {
+  pid_t pid = ForkWithoutSigHandlers();
+  if (pid == 0) {
+    StartPgrp();
+    const char *args[2] = {"/bin/true", NULL};
+    ExecvHelper("/bin/true", args);
+    _exit(EXIT_FAILURE);
+  }
+  return pid;
+}
+
+//! Starts /bin/true using SpawnHelper().
+static pid_t SpawnTrue(void) {
+  const char *args[2] = {"/bin/true", NULL};
+  SpawnOptions options = {-1, -1, /*new_pgrp=*/1, NULL, NULL};
+  return SpawnHelper("/bin/true", args, &options);
+}
+
+//! Runs one method the given number of times and prints its percentiles.
+static int Measure(const char *name, pid_t (*start)(void), int iterations) {
+  double *times = malloc(iterations * sizeof(*times));
+  if (times == NULL) {
+    fprintf(stderr, "malloc failed\n");
+    return -1;
+  }
+  for (int i = 0; i < iterations; ++i) {
+    double t0 = NowUs();
+    pid_t pid = start();
+    times[i] = NowUs() - t0;
+    if (pid == -1) {
+      fprintf(stderr, "%s failed\n", name);
+      free(times);
+      return -1;
+    }
+    int status;
+    WaitPgrp(name, &pid, 1, 0, &status);
+  }
+  qsort(times, iterations, sizeof(*times), CompareDoubles);
+  printf("%-6s p50=%8.1f us  p95=%8.1f us  p99=%8.1f us  (n=%d)\n", name,
+         times[iterations / 2], times[iterations * 95 / 100],
+         times[iterations * 99 / 100], iterations);
+  free(times);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 200;
+  int resident_mib = argc > 2 ? atoi(argv[2]) : 256;
+  if (iterations <= 0 || resident_mib < 0) {
+    fprintf(stderr, "Usage: %s [iterations [resident_mib]]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  size_t size = (size_t)resident_mib << 20;
+  char *ballast = malloc(size ? size : 1);
+  if (ballast == NULL) {
+    fprintf(stderr, "Could not allocate %d MiB\n", resident_mib);
+    return EXIT_FAILURE;
+  }
+  memset(ballast, 1, size);
+  if (mlock(ballast, size)) {
+    // Still resident as we just touched it; just not pinned.
+    fprintf(stderr, "Note: could not mlock %d MiB\n", resident_mib);
+  }
+
+  InitWakeupPipe();
+  InitWaitPgrp();
+  printf("Starting /bin/true with %d MiB resident, pidfds %s:\n",
+         resident_mib, HavePidfds() ? "available" : "unavailable");
+  if (Measure("fork", ForkTrue, iterations) ||
+      Measure("spawn", SpawnTrue, iterations)) {
+    return EXIT_FAILURE;
+  }
+  free(ballast);
+  return 0;
+}
@@ -4,23 +4,330 @@
 #include <X11/Xlib.h>         // for XFree, XGetWindowAttributes, XMapWindow
 #include <X11/Xmu/WinUtil.h>  // for XmuClientWindow
 #include <X11/Xutil.h>        // for XClassHint, XGetClassHint
-#include <string.h>           // for NULL, strcmp
+#include <stdlib.h>           // for calloc, free, malloc
+#include <string.h>           // for NULL, memchr, strcmp
 
-int InitUnmapAllWindowsState(UnmapAllWindowsState* state, Display* display,
-                             Window root_window, const Window* ignored_windows,
-                             unsigned int n_ignored_windows,
-                             const char* my_res_class, const char* my_res_name,
-                             int include_frame) {
-  int should_proceed = 1;
-  state->display = display;
-  state->root_window = root_window;
-  state->windows = NULL;
-  state->n_windows = 0;
+#ifdef HAVE_XCB
+#include <X11/Xlib-xcb.h>  // for XGetXCBConnection
+#include <xcb/xcb.h>       // for xcb_get_property, xcb_query_tree
+#endif
 
-  Window unused_root_return, unused_parent_return;
-  XQueryTree(state->display, state->root_window, &unused_root_return,
-             &unused_parent_return, &state->windows, &state->n_windows);
-  state->first_unmapped_window = state->n_windows;  // That means none unmapped.
+//! A set of windows, for fast lookup of the ignored windows.
+typedef struct {
+  //! Open addressing hash table; None marks free slots.
+  Window* slots;
+  //! Number of slots, always a power of two.
+  size_t n_slots;
+  //! The original window list, used as a fallback if allocation failed.
+  const Window* windows;
+  unsigned int n_windows;
+} WindowSet;
+
+static size_t WindowSetSlot(const WindowSet* set, Window w) {
+  // Window IDs are allocated sequentially in the low bits, so a
+  // multiplicative hash spreads them well enough.
+  return (size_t)(w * 2654435761UL) & (set->n_slots - 1);
+}
+
+static void InitWindowSet(WindowSet* set, const Window* windows,
+                          unsigned int n_windows) {
+  set->windows = windows;
+  set->n_windows = n_windows;
+  set->n_slots = 1;
+  while (set->n_slots < 2 * (size_t)n_windows) {
+    set->n_slots *= 2;
+  }
+  set->slots = calloc(set->n_slots, sizeof(*set->slots));
+  if (set->slots == NULL) {
+    return;
+  }
+  for (unsigned int i = 0; i < n_windows; ++i) {
+    if (windows[i] == None) {
+      continue;
+    }
+    size_t slot = WindowSetSlot(set, windows[i]);
+    while (set->slots[slot] != None && set->slots[slot] != windows[i]) {
+      slot = (slot + 1) & (set->n_slots - 1);
+    }
+    set->slots[slot] = windows[i];
+  }
+}
+
+static int WindowSetContains(const WindowSet* set, Window w) {
+  if (set->slots == NULL) {
+    for (unsigned int i = 0; i < set->n_windows; ++i) {
+      if (set->windows[i] == w) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+  size_t slot = WindowSetSlot(set, w);
+  while (set->slots[slot] != None) {
+    if (set->slots[slot] == w) {
+      return 1;
+    }
+    slot = (slot + 1) & (set->n_slots - 1);
+  }
+  return 0;
+}
+
+static void ClearWindowSet(WindowSet* set) {
+  free(set->slots);
+  set->slots = NULL;
+  set->n_slots = 0;
+}
+
+/*! \brief Decides based on the class hint whether to unmap a window.
+ *
+ * \return Zero if the window must not be unmapped.
+ */
+static int CheckClassHint(const char* res_name, const char* res_class,
+                          const char* my_res_class, const char* my_res_name,
+                          int* should_proceed) {
+  // If any window has my window class, we better not proceed with
+  // unmapping as doing so could accidentally unlock the screen or
+  // otherwise cause more damage than good.
+  if ((my_res_class || my_res_name) &&
+      (!my_res_class || strcmp(my_res_class, res_class) == 0) &&
+      (!my_res_name || strcmp(my_res_name, res_name) == 0)) {
+    *should_proceed = 0;
+    return 0;
+  }
+  // HACK: Bspwm creates some subwindows of the root window that we
+  // absolutely shouldn't ever unmap, as remapping them confuses Bspwm.
+  if (!strcmp(res_class, "Bspwm")) {
+    return 0;
+  }
+  return 1;
+}
+
+#ifdef HAVE_XCB
+//! A window whose client window is still being searched for.
+typedef struct {
+  //! Index into the state's window list.
+  unsigned int index;
+  //! The candidate window to check for WM_STATE.
+  xcb_window_t window;
+} ClientSearchEntry;
+
+/*! \brief Replaces all windows by their client windows.
+ *
+ * Equivalent to calling XmuClientWindow on all windows, but searches all of
+ * them at the same time, level by level, with only two round trips per level.
+ *
+ * \return Zero if out of memory.
+ */
+static int FindClientWindowsXCB(UnmapAllWindowsState* state,
+                                xcb_connection_t* conn, xcb_atom_t wm_state) {
+  if (wm_state == XCB_ATOM_NONE) {
+    // Nobody set WM_STATE yet, so every window is its own client window.
+    return 1;
+  }
+  size_t n_entries = 0;
+  ClientSearchEntry* entries = malloc(state->n_windows * sizeof(*entries));
+  unsigned char* found = calloc(state->n_windows, 1);
+  if ((state->n_windows != 0 && entries == NULL) ||
+      (state->n_windows != 0 && found == NULL)) {
+    free(entries);
+    free(found);
+    return 0;
+  }
+  for (unsigned int i = 0; i < state->n_windows; ++i) {
+    if (state->windows[i] != None) {
+      entries[n_entries].index = i;
+      entries[n_entries].window = state->windows[i];
+      ++n_entries;
+    }
+  }
+  int ok = 1;
+  while (n_entries != 0) {
+    union {
+      xcb_get_property_cookie_t property;
+      xcb_query_tree_cookie_t tree;
+    }* cookies = malloc(n_entries * sizeof(*cookies));
+    if (cookies == NULL) {
+      ok = 0;
+      break;
+    }
+    for (size_t k = 0; k < n_entries; ++k) {
+      cookies[k].property = xcb_get_property(
+          conn, 0, entries[k].window, wm_state, XCB_GET_PROPERTY_TYPE_ANY, 0, 0);
+    }
+    for (size_t k = 0; k < n_entries; ++k) {
+      xcb_get_property_reply_t* reply =
+          xcb_get_property_reply(conn, cookies[k].property, NULL);
+      unsigned int i = entries[k].index;
+      if (reply != NULL && reply->type != XCB_ATOM_NONE && !found[i]) {
+        state->windows[i] = entries[k].window;
+        found[i] = 1;
+      }
+      free(reply);
+    }
+    // Descend one level for all windows that have not been found yet.
+    size_t n_pending = 0;
+    for (size_t k = 0; k < n_entries; ++k) {
+      if (!found[entries[k].index]) {
+        entries[n_pending] = entries[k];
+        cookies[n_pending].tree = xcb_query_tree(conn, entries[k].window);
+        ++n_pending;
+      }
+    }
+    ClientSearchEntry* next = NULL;
+    size_t n_next = 0;
+    for (size_t k = 0; k < n_pending; ++k) {
+      xcb_query_tree_reply_t* reply =
+          xcb_query_tree_reply(conn, cookies[k].tree, NULL);
+      if (reply == NULL) {
+        continue;
+      }
+      int n_children = xcb_query_tree_children_length(reply);
+      ClientSearchEntry* grown =
+          (ok && n_children != 0)
+              ? realloc(next, (n_next + n_children) * sizeof(*next))
+              : NULL;
+      if (n_children != 0 && grown == NULL) {
+        // Keep collecting the replies, but give up afterwards.
+        ok = 0;
+      } else if (n_children != 0) {
+        next = grown;
+        const xcb_window_t* children = xcb_query_tree_children(reply);
+        for (int c = 0; c < n_children; ++c) {
+          next[n_next].index = entries[k].index;
+          next[n_next].window = children[c];
+          ++n_next;
+        }
+      }
+      free(reply);
+    }
+    free(cookies);
+    free(entries);
+    entries = next;
+    n_entries = ok ? n_next : 0;
+  }
+  free(entries);
+  free(found);
+  return ok;
+}
+
+/*! \brief Scans the windows using XCB.
+ *
+ * All requests of each step are sent at once before waiting for any reply, so
+ * the number of round trips does not grow with the number of windows. This
+ * matters as this runs while the X server is grabbed.
+ *
+ * \return Zero if out of memory, in which case the state is unchanged.
+ */
+static int ScanWindowsXCB(UnmapAllWindowsState* state,
+                          const WindowSet* ignored, const char* my_res_class,
+                          const char* my_res_name, int include_frame,
+                          int* should_proceed) {
+  xcb_connection_t* conn = XGetXCBConnection(state->display);
+  Window* windows = malloc(state->n_windows * sizeof(*windows));
+  union {
+    xcb_get_window_attributes_cookie_t attributes;
+    xcb_get_property_cookie_t property;
+  }* cookies = malloc(state->n_windows * sizeof(*cookies));
+  if (state->n_windows != 0 && (windows == NULL || cookies == NULL)) {
+    free(windows);
+    free(cookies);
+    return 0;
+  }
+
+  // Fetch the map state of all windows, and the WM_STATE atom too.
+  xcb_intern_atom_cookie_t wm_state_cookie =
+      xcb_intern_atom(conn, 1, strlen("WM_STATE"), "WM_STATE");
+  for (unsigned int i = 0; i < state->n_windows; ++i) {
+    cookies[i].attributes =
+        xcb_get_window_attributes(conn, state->windows[i]);
+  }
+  xcb_intern_atom_reply_t* wm_state_reply =
+      xcb_intern_atom_reply(conn, wm_state_cookie, NULL);
+  xcb_atom_t wm_state =
+      wm_state_reply != NULL ? wm_state_reply->atom : XCB_ATOM_NONE;
+  free(wm_state_reply);
+  for (unsigned int i = 0; i < state->n_windows; ++i) {
+    xcb_get_window_attributes_reply_t* reply =
+        xcb_get_window_attributes_reply(conn, cookies[i].attributes, NULL);
+    // Not mapped -> nothing to do.
+    windows[i] = (reply == NULL || reply->map_state == XCB_MAP_STATE_UNMAPPED)
+                     ? None
+                     : state->windows[i];
+    free(reply);
+  }
+
+  // Go down to the next WM_STATE window if available, as unmapping window
+  // frames may confuse WMs.
+  Window* original_windows = state->windows;
+  state->windows = windows;
+  int ok = include_frame || FindClientWindowsXCB(state, conn, wm_state);
+  state->windows = original_windows;
+  if (!ok) {
+    free(windows);
+    free(cookies);
+    return 0;
+  }
+
+  // If any window we'd be unmapping is in the ignore list, skip it.
+  for (unsigned int i = 0; i < state->n_windows; ++i) {
+    if (windows[i] != None && WindowSetContains(ignored, windows[i])) {
+      windows[i] = None;
+    }
+  }
+
+  // Same as XGetClassHint.
+  for (unsigned int i = 0; i < state->n_windows; ++i) {
+    if (windows[i] != None) {
+      cookies[i].property =
+          xcb_get_property(conn, 0, windows[i], XCB_ATOM_WM_CLASS,
+                           XCB_ATOM_STRING, 0, 2048);
+    }
+  }
+  for (unsigned int i = 0; i < state->n_windows; ++i) {
+    if (windows[i] == None) {
+      continue;
+    }
+    xcb_get_property_reply_t* reply =
+        xcb_get_property_reply(conn, cookies[i].property, NULL);
+    if (reply == NULL || reply->type != XCB_ATOM_STRING ||
+        reply->format != 8) {
+      free(reply);
+      continue;
+    }
+    // The property contains res_name and res_class, each NUL terminated. Be
+    // lenient like Xlib if the terminators are missing.
+    int len = xcb_get_property_value_length(reply);
+    char* value = malloc(len + 2);
+    if (value != NULL) {
+      memcpy(value, xcb_get_property_value(reply), len);
+      value[len] = 0;
+      value[len + 1] = 0;
+      const char* res_name = value;
+      const char* res_class = (char*)memchr(value, 0, len + 1) + 1;
+      if (!CheckClassHint(res_name, res_class, my_res_class, my_res_name,
+                          should_proceed)) {
+        windows[i] = None;
+      }
+      free(value);
+    }
+    free(reply);
+  }
+  free(cookies);
+
+  for (unsigned int i = 0; i < state->n_windows; ++i) {
+    state->windows[i] = windows[i];
+  }
+  free(windows);
+  return 1;
+}
+#endif
+
+//! Scans the windows using Xlib, one round trip at a time.
+static void ScanWindowsXlib(UnmapAllWindowsState* state,
+                            const WindowSet* ignored, const char* my_res_class,
+                            const char* my_res_name, int include_frame,
+                            int* should_proceed) {
+  Display* display = state->display;
   for (unsigned int i = 0; i < state->n_windows; ++i) {
     XWindowAttributes xwa;
     XGetWindowAttributes(display, state->windows[i], &xwa);
@@ -35,28 +342,14 @@ int InitUnmapAllWindowsState(UnmapAllWindowsState* state, Display* display,
       state->windows[i] = XmuClientWindow(display, state->windows[i]);
     }
     // If any window we'd be unmapping is in the ignore list, skip it.
-    for (unsigned int j = 0; j < n_ignored_windows; ++j) {
-      if (state->windows[i] == ignored_windows[j]) {
-        state->windows[i] = None;
-      }
-    }
-    if (state->windows[i] == None) {
+    if (WindowSetContains(ignored, state->windows[i])) {
+      state->windows[i] = None;
       continue;
     }
     XClassHint cls;
     if (XGetClassHint(state->display, state->windows[i], &cls)) {
-      // If any window has my window class, we better not proceed with
-      // unmapping as doing so could accidentally unlock the screen or
-      // otherwise cause more damage than good.
-      if ((my_res_class || my_res_name) &&
-          (!my_res_class || strcmp(my_res_class, cls.res_class) == 0) &&
-          (!my_res_name || strcmp(my_res_name, cls.res_name) == 0)) {
-        state->windows[i] = None;
-        should_proceed = 0;
-      }
-      // HACK: Bspwm creates some subwindows of the root window that we
-      // absolutely shouldn't ever unmap, as remapping them confuses Bspwm.
-      if (!strcmp(cls.res_class, "Bspwm")) {
+      if (!CheckClassHint(cls.res_name, cls.res_class, my_res_class,
+                          my_res_name, should_proceed)) {
         state->windows[i] = None;
       }
       XFree(cls.res_class);
@@ -65,6 +358,33 @@ int InitUnmapAllWindowsState(UnmapAllWindowsState* state, Display* display,
       cls.res_name = NULL;
     }
   }
+}
+
+int InitUnmapAllWindowsState(UnmapAllWindowsState* state, Display* display,
+                             Window root_window, const Window* ignored_windows,
+                             unsigned int n_ignored_windows,
+                             const char* my_res_class, const char* my_res_name,
+                             int include_frame) {
+  int should_proceed = 1;
+  state->display = display;
+  state->root_window = root_window;
+  state->windows = NULL;
+  state->n_windows = 0;
+
+  Window unused_root_return, unused_parent_return;
+  XQueryTree(state->display, state->root_window, &unused_root_return,
+             &unused_parent_return, &state->windows, &state->n_windows);
+  state->first_unmapped_window = state->n_windows;  // That means none unmapped.
+
+  WindowSet ignored;
+  InitWindowSet(&ignored, ignored_windows, n_ignored_windows);
+#ifdef HAVE_XCB
+  if (!ScanWindowsXCB(state, &ignored, my_res_class, my_res_name,
+                      include_frame, &should_proceed))
+#endif
+    ScanWindowsXlib(state, &ignored, my_res_class, my_res_name, include_frame,
+                    &should_proceed);
+  ClearWindowSet(&ignored);
   return should_proceed;
 }
 
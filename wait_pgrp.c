@@ -14,23 +14,150 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+// For POSIX_SPAWN_SETSID and posix_spawn_file_actions_addchdir_np.
+#define _GNU_SOURCE
+
 #include "wait_pgrp.h"
 
 #include <errno.h>   // for errno, ECHILD, EINTR, ESRCH
+#include <fcntl.h>   // for fcntl, FD_CLOEXEC, F_DUPFD_CLOEXEC, F_GETFD
+#include <poll.h>    // for poll, pollfd, POLLIN
 #include <signal.h>  // for kill, sigaddset, sigemptyset, sigprocmask,
                      // sigsuspend, SIGCHLD, SIGTERM
 #include <stdio.h>
 #include <stdlib.h>  // for EXIT_SUCCESS, WEXITSTATUS, WIFEXITED, WIFSIGNALED
 #include <string.h>
+#include <spawn.h>     // for posix_spawn, posix_spawnattr_t, POSIX_SPAWN_...
 #include <sys/wait.h>  // for waitpid, WNOHANG
 #include <unistd.h>    // for pid_t
 
-#include "logging.h"  // for Log, LogErrno
+#ifdef HAVE_PIDFD_OPEN
+#include <sys/pidfd.h>  // for pidfd_open, pidfd_send_signal
+#endif
+
+#include "logging.h"      // for Log, LogErrno
+#include "wakeup_pipe.h"  // for PokeWakeupPipe
+
+//! The environment, for passing it to posix_spawn().
+extern char **environ;
+
+//! Whether the kernel supports pidfds. Probed by InitWaitPgrp().
+static int have_pidfd = 0;
+
+/*! \brief Whether our parent holds a pidfd to us.
+ *
+ * Set in child processes forked by ForkWithoutSigHandlers(). Only then can
+ * StartPgrp() skip the pgrp_placeholder process.
+ */
+static int parent_has_pidfd = 0;
+
+/*! \brief The pidfds of our child processes.
+ *
+ * A child is only ever reaped after its entry has been removed from this table,
+ * so while it is in here, its PID (and process group ID) cannot be reused.
+ */
+static struct {
+  pid_t pid;
+  int fd;
+} child_pidfds[MAX_CHILD_PIDFDS];
+
+//! Returns the pidfd of the given child, or -1 if there is none.
+static int FindPidfd(pid_t pid) {
+  for (int i = 0; i < MAX_CHILD_PIDFDS; ++i) {
+    if (child_pidfds[i].pid == pid && pid != 0) {
+      return child_pidfds[i].fd;
+    }
+  }
+  return -1;
+}
+
+//! Returns whether RegisterPidfd() has a free slot to use.
+static int HaveFreePidfdSlot(void) {
+  if (!have_pidfd) {
+    return 0;
+  }
+  for (int i = 0; i < MAX_CHILD_PIDFDS; ++i) {
+    if (child_pidfds[i].pid == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*! \brief Remembers a pidfd for the given freshly forked child.
+ *
+ * \return True if the child is now tracked using a pidfd.
+ */
+static int RegisterPidfd(pid_t pid) {
+#ifdef HAVE_PIDFD_OPEN
+  if (!have_pidfd) {
+    return 0;
+  }
+  for (int i = 0; i < MAX_CHILD_PIDFDS; ++i) {
+    if (child_pidfds[i].pid == 0) {
+      // The child cannot have been reaped yet, so this is race-free.
+      int fd = pidfd_open(pid, 0);
+      if (fd < 0) {
+        LogErrno("pidfd_open %d", (int)pid);
+        return 0;
+      }
+      child_pidfds[i].pid = pid;
+      child_pidfds[i].fd = fd;
+      return 1;
+    }
+  }
+  Log("Too many child processes - not using a pidfd for %d", (int)pid);
+#else
+  (void)pid;
+#endif
+  return 0;
+}
+
+/*! \brief Kills and reaps a child we failed to track using a pidfd.
+ *
+ * Such a child may already have started a process group without a
+ * pgrp_placeholder, so we must not let it run untracked.
+ */
+static void DiscardUntrackedChild(pid_t pid) {
+  // The child is not reaped yet, so both its PID and any process group it
+  // leads are still reserved.
+  if (kill(-pid, SIGKILL) < 0 && errno != ESRCH) {
+    LogErrno("kill(-%d)", (int)pid);
+  }
+  if (kill(pid, SIGKILL) < 0) {
+    LogErrno("kill(%d)", (int)pid);
+  }
+  while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+  }
+}
+
+//! Forgets the pidfd of the given child, if any.
+static void UnregisterPidfd(pid_t pid) {
+  for (int i = 0; i < MAX_CHILD_PIDFDS; ++i) {
+    if (child_pidfds[i].pid == pid && pid != 0) {
+      close(child_pidfds[i].fd);
+      child_pidfds[i].pid = 0;
+      child_pidfds[i].fd = -1;
+    }
+  }
+}
+
+//! Forgets all pidfds; used in child processes, which did not fork these.
+static void ClearPidfds(void) {
+  for (int i = 0; i < MAX_CHILD_PIDFDS; ++i) {
+    if (child_pidfds[i].pid != 0) {
+      close(child_pidfds[i].fd);
+      child_pidfds[i].pid = 0;
+      child_pidfds[i].fd = -1;
+    }
+  }
+}
 
 static void HandleSIGCHLD(int unused_signo) {
   // No handling needed - we just want to interrupt select() or sigsuspend()
-  // calls.
+  // calls, and wake up event loops waiting on the wakeup pipe.
   (void)unused_signo;
+  PokeWakeupPipe();
 }
 
 void InitWaitPgrp(void) {
@@ -41,6 +168,26 @@ void InitWaitPgrp(void) {
   if (sigaction(SIGCHLD, &sa, NULL) != 0) {
     LogErrno("sigaction(SIGCHLD)");
   }
+#ifdef HAVE_PIDFD_OPEN
+  // The C library may support pidfds while the kernel does not (Linux < 5.3).
+  int fd = pidfd_open(getpid(), 0);
+  if (fd >= 0) {
+    close(fd);
+    have_pidfd = 1;
+  }
+#endif
+}
+
+int HavePidfds(void) { return have_pidfd; }
+
+int GetChildPidfds(int *fds, int max_fds) {
+  int n = 0;
+  for (int i = 0; i < MAX_CHILD_PIDFDS && n < max_fds; ++i) {
+    if (child_pidfds[i].pid != 0) {
+      fds[n++] = child_pidfds[i].fd;
+    }
+  }
+  return n;
 }
 
 pid_t ForkWithoutSigHandlers(void) {
@@ -50,10 +197,14 @@ pid_t ForkWithoutSigHandlers(void) {
   sigaddset(&set, SIGUSR1);
   sigaddset(&set, SIGTERM);
   sigaddset(&set, SIGCHLD);
+  sigaddset(&set, SIGTSTP);
+  sigaddset(&set, SIGCONT);
   sigemptyset(&oldset);
   if (sigprocmask(SIG_BLOCK, &set, &oldset)) {
     LogErrno("Unable to block signals");
   }
+  // Decide before forking, so the child knows whether to rely on the pidfd.
+  int use_pidfd = HaveFreePidfdSlot();
   pid_t pid = fork();
   int fork_errno = errno;
   if (pid == 0) {
@@ -71,6 +222,18 @@ pid_t ForkWithoutSigHandlers(void) {
     if (sigaction(SIGCHLD, &sa, NULL)) {
       LogErrno("sigaction(SIGCHLD)");
     }
+    if (sigaction(SIGTSTP, &sa, NULL)) {
+      LogErrno("sigaction(SIGTSTP)");
+    }
+    if (sigaction(SIGCONT, &sa, NULL)) {
+      LogErrno("sigaction(SIGCONT)");
+    }
+    ClearPidfds();
+    parent_has_pidfd = use_pidfd;
+  } else if (pid > 0 && use_pidfd && !RegisterPidfd(pid)) {
+    fork_errno = errno;
+    DiscardUntrackedChild(pid);
+    pid = -1;
   }
   // Now we can unmask signals.
   if (sigprocmask(SIG_SETMASK, &oldset, NULL)) {
@@ -84,6 +247,11 @@ void StartPgrp(void) {
   if (setsid() == (pid_t)-1) {
     LogErrno("setsid");
   }
+  if (parent_has_pidfd) {
+    // Our parent holds a pidfd to us and kills the process group before
+    // reaping us, so our PID cannot be reused while the group is signaled.
+    return;
+  }
   // To avoid a race condition when killing the process group after the leader
   // is already dead (which could then kill another new process group with the
   // same ID), we'll create a dummy process that never dies until we signal the
@@ -130,9 +298,237 @@ int ExecvHelper(const char *path, const char *const argv[]) {
   return -1;
 }
 
+/*! \brief Makes fd become target_fd in a forked child.
+ *
+ * \return Zero if the operation succeeded.
+ */
+static int RedirectFd(int fd, int target_fd) {
+  if (fd < 0) {
+    return 0;
+  }
+  if (fd == target_fd) {
+    // Make sure it survives exec.
+    int flags = fcntl(fd, F_GETFD);
+    if (flags == -1 || fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC) == -1) {
+      LogErrno("fcntl(FD_CLOEXEC)");
+      return -1;
+    }
+    return 0;
+  }
+  if (dup2(fd, target_fd) == -1) {
+    LogErrno("dup2");
+    return -1;
+  }
+  return 0;
+}
+
+//! Spawns a helper using fork(); see SpawnHelper().
+static pid_t ForkHelper(const char *path, const char *const argv[],
+                        const SpawnOptions *options, int stdout_fd) {
+  pid_t pid = ForkWithoutSigHandlers();
+  if (pid != 0) {
+    return pid;
+  }
+  // Child process.
+  if (options->new_pgrp) {
+    StartPgrp();
+  }
+  for (const char *const *var = options->env; var != NULL && *var != NULL;
+       ++var) {
+    if (putenv((char *)*var)) {
+      LogErrno("putenv");
+    }
+  }
+  if (RedirectFd(options->stdin_fd, 0) || RedirectFd(stdout_fd, 1)) {
+    _exit(EXIT_FAILURE);
+  }
+  if (options->stdin_fd > 2) {
+    close(options->stdin_fd);
+  }
+  if (stdout_fd > 2 && stdout_fd != options->stdin_fd) {
+    close(stdout_fd);
+  }
+  if (options->before_exec != NULL) {
+    options->before_exec();
+  }
+  ExecvHelper(path, argv);
+  // No need to sleep here; callers delay restarting children that fail.
+  _exit(EXIT_FAILURE);
+}
+
+#if defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP) && \
+    defined(POSIX_SPAWN_SETSID)
+/*! \brief Returns our environment with the given variables added.
+ *
+ * \return A newly allocated array (but the strings are not copied), or NULL
+ *   if out of memory.
+ */
+static char **BuildEnv(const char *const *vars) {
+  size_t n_environ = 0, n_vars = 0;
+  while (environ[n_environ] != NULL) {
+    ++n_environ;
+  }
+  while (vars[n_vars] != NULL) {
+    ++n_vars;
+  }
+  char **env = malloc((n_environ + n_vars + 1) * sizeof(*env));
+  if (env == NULL) {
+    return NULL;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < n_environ; ++i) {
+    // Skip variables that get overridden.
+    int overridden = 0;
+    for (size_t j = 0; j < n_vars && !overridden; ++j) {
+      const char *eq = strchr(vars[j], '=');
+      size_t len = eq ? (size_t)(eq - vars[j]) : strlen(vars[j]);
+      overridden = !strncmp(environ[i], vars[j], len) &&
+                   (environ[i][len] == '=' || environ[i][len] == 0);
+    }
+    if (!overridden) {
+      env[n++] = environ[i];
+    }
+  }
+  for (size_t j = 0; j < n_vars; ++j) {
+    env[n++] = (char *)vars[j];
+  }
+  env[n] = NULL;
+  return env;
+}
+
+/*! \brief Spawns a helper using posix_spawn(); see SpawnHelper().
+ *
+ * \param exec_failed Set to whether posix_spawn() itself failed, e.g. as the
+ *   helper could not be executed; then trying again using fork() is futile.
+ */
+static pid_t PosixSpawnHelper(const char *path, const char *const argv[],
+                              const SpawnOptions *options, int stdout_fd,
+                              int *exec_failed) {
+  char **env = environ;
+  if (options->env != NULL) {
+    env = BuildEnv(options->env);
+    if (env == NULL) {
+      LogErrno("malloc");
+      return -1;
+    }
+  }
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t actions;
+  int err = posix_spawnattr_init(&attr);
+  if (err == 0) {
+    err = posix_spawn_file_actions_init(&actions);
+    if (err != 0) {
+      posix_spawnattr_destroy(&attr);
+    }
+  }
+  if (err != 0) {
+    if (env != environ) {
+      free(env);
+    }
+    errno = err;
+    LogErrno("posix_spawn setup");
+    return -1;
+  }
+
+  // Same signals as in ForkWithoutSigHandlers().
+  sigset_t sigdefault;
+  sigemptyset(&sigdefault);
+  sigaddset(&sigdefault, SIGUSR1);
+  sigaddset(&sigdefault, SIGTERM);
+  sigaddset(&sigdefault, SIGCHLD);
+  sigaddset(&sigdefault, SIGTSTP);
+  sigaddset(&sigdefault, SIGCONT);
+  pid_t pid = -1;
+  short flags = POSIX_SPAWN_SETSIGDEF;
+  if (options->new_pgrp) {
+    // No pgrp_placeholder needed, as we will track the child using a pidfd.
+    flags |= POSIX_SPAWN_SETSID;
+  }
+  if (posix_spawnattr_setsigdefault(&attr, &sigdefault) ||
+      posix_spawnattr_setflags(&attr, flags) ||
+      // Same as ExecvHelper().
+      posix_spawn_file_actions_addchdir_np(&actions, HELPER_PATH) ||
+      (options->stdin_fd >= 0 &&
+       posix_spawn_file_actions_adddup2(&actions, options->stdin_fd, 0)) ||
+      (stdout_fd >= 0 &&
+       posix_spawn_file_actions_adddup2(&actions, stdout_fd, 1)) ||
+      (options->stdin_fd > 2 &&
+       posix_spawn_file_actions_addclose(&actions, options->stdin_fd)) ||
+      (stdout_fd > 2 && stdout_fd != options->stdin_fd &&
+       posix_spawn_file_actions_addclose(&actions, stdout_fd))) {
+    Log("posix_spawn setup failed");
+  } else {
+    err = posix_spawn(&pid, path, &actions, &attr, (char *const *)argv, env);
+    if (err == 0) {
+      if (!RegisterPidfd(pid) && options->new_pgrp) {
+        // There is no pgrp_placeholder to fall back to.
+        DiscardUntrackedChild(pid);
+        pid = -1;
+      }
+    } else {
+      errno = err;
+      LogErrno("posix_spawn %s", path);
+      *exec_failed = 1;
+      pid = -1;
+    }
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (env != environ) {
+    free(env);
+  }
+  return pid;
+}
+#endif
+
+pid_t SpawnHelper(const char *path, const char *const argv[],
+                  const SpawnOptions *options) {
+  // If stdout_fd is 0, it would get overwritten by stdin_fd, so move it away.
+  int stdout_fd = options->stdout_fd;
+  int moved_stdout_fd = -1;
+  if (stdout_fd == 0 && options->stdin_fd >= 0) {
+    moved_stdout_fd = fcntl(stdout_fd, F_DUPFD_CLOEXEC, 3);
+    if (moved_stdout_fd == -1) {
+      LogErrno("fcntl(F_DUPFD_CLOEXEC)");
+      return -1;
+    }
+    stdout_fd = moved_stdout_fd;
+  }
+  pid_t pid = -1;
+  int exec_failed = 0;
+#if defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP) && \
+    defined(POSIX_SPAWN_SETSID)
+  // Without a pidfd, a new process group needs a pgrp_placeholder process,
+  // which must be forked from the child. Likewise, before_exec must run in a
+  // forked child.
+  if (options->before_exec == NULL &&
+      (!options->new_pgrp || HaveFreePidfdSlot())) {
+    pid = PosixSpawnHelper(path, argv, options, stdout_fd, &exec_failed);
+  }
+#endif
+  if (pid == -1 && !exec_failed) {
+    pid = ForkHelper(path, argv, options, stdout_fd);
+    if (pid == -1) {
+      LogErrno("fork");
+    }
+  }
+  if (moved_stdout_fd != -1) {
+    close(moved_stdout_fd);
+  }
+  return pid;
+}
+
 int KillPgrp(pid_t pid, int signo) {
   int ret = kill(-pid, signo);
   if (ret < 0 && errno == ESRCH) {
+#ifdef HAVE_PIDFD_OPEN
+    int fd = FindPidfd(pid);
+    if (fd >= 0) {
+      // The child has not called setsid() yet, or already died. Unlike kill(),
+      // this cannot hit an unrelated process that reused the PID.
+      return pidfd_send_signal(fd, signo, NULL, 0);
+    }
+#endif
     // Note: this shouldn't happen as StartPgrp() should ensure that we never
     // get here. Remove this workaround once we made sure this really does not
     // happen. TODO(divVerent).
@@ -146,9 +542,18 @@ int KillPgrp(pid_t pid, int signo) {
   return ret;
 }
 
+static int DoWaitProc(const char *name, pid_t *pid, int do_block,
+                      int already_killed, int kill_pgrp, int *exit_status);
+
 int WaitPgrp(const char *name, pid_t *pid, int do_block, int already_killed,
              int *exit_status) {
   int pid_saved = *pid;
+  if (FindPidfd(pid_saved) >= 0) {
+    // Kill the process group while the leader is a zombie and thus still
+    // reserves the process group ID.
+    return DoWaitProc(name, pid, do_block, already_killed, !already_killed,
+                      exit_status);
+  }
   int result = WaitProc(name, pid, do_block, already_killed, exit_status);
   if (result && !already_killed) {
     if (KillPgrp(pid_saved, SIGTERM) < 0) {
@@ -160,6 +565,45 @@ int WaitPgrp(const char *name, pid_t *pid, int do_block, int already_killed,
 
 int WaitProc(const char *name, pid_t *pid, int do_block, int already_killed,
              int *exit_status) {
+  return DoWaitProc(name, pid, do_block, already_killed, 0, exit_status);
+}
+
+/*! \brief Waits for a child's pidfd to become readable, i.e. for it to exit.
+ *
+ * \return 1 if the child exited, 0 if it is still alive, -1 on error.
+ */
+static int PollPidfd(int fd, int do_block) {
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  for (;;) {
+    int ret = poll(&pfd, 1, do_block ? -1 : 0);
+    if (ret >= 0) {
+      return ret > 0;
+    }
+    if (errno != EINTR) {
+      LogErrno("poll(pidfd)");
+      return -1;
+    }
+  }
+}
+
+static int DoWaitProc(const char *name, pid_t *pid, int do_block,
+                      int already_killed, int kill_pgrp, int *exit_status) {
+  int fd = FindPidfd(*pid);
+  if (fd >= 0) {
+    // Fast path: no need to touch signal masks or call waitpid() while the
+    // child is still running.
+    int exited = PollPidfd(fd, do_block);
+    if (exited == 0) {
+      return 0;  // Child still lives.
+    }
+    if (exited > 0 && kill_pgrp) {
+      if (kill(-*pid, SIGTERM) < 0 && errno != ESRCH) {
+        LogErrno("KillPgrp %s", name);
+      }
+    }
+  }
   sigset_t oldset, set;
   sigemptyset(&set);
   // We're blocking the signals we may have forwarding handlers for as their
@@ -187,6 +631,7 @@ int WaitProc(const char *name, pid_t *pid, int do_block, int already_killed,
           // The process is already dead. Fine. Although this shouldn't happen.
           Log("%s child died without us noticing - please fix", name);
           *exit_status = WAIT_ALREADY_DEAD;
+          UnregisterPidfd(*pid);
           *pid = 0;
           result = 1;
           break;
@@ -205,6 +650,7 @@ int WaitProc(const char *name, pid_t *pid, int do_block, int already_killed,
           Log("%s child killed by signal %d", name, signo);
         }
         *exit_status = (signo > 0) ? -signo : WAIT_NONPOSITIVE_SIGNAL;
+        UnregisterPidfd(*pid);
         *pid = 0;
         result = 1;
       } else if (WIFEXITED(status)) {
@@ -212,6 +658,7 @@ int WaitProc(const char *name, pid_t *pid, int do_block, int already_killed,
         if (*exit_status != EXIT_SUCCESS) {
           Log("%s child failed with status %d", name, *exit_status);
         }
+        UnregisterPidfd(*pid);
         *pid = 0;
         result = 1;
       }
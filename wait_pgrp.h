@@ -23,16 +23,41 @@ limitations under the License.
 #define WAIT_ALREADY_DEAD INT_MIN
 #define WAIT_NONPOSITIVE_SIGNAL (INT_MIN + 1)
 
+//! The maximum number of child processes tracked using pidfds.
+#define MAX_CHILD_PIDFDS 32
+
 /*! \brief Initializes WaitPgrp.
  *
  * Actually just installs an empty SIGCHLD handler so select(), sigsuspend()
- * etc. get interrupted by the signal.
+ * etc. get interrupted by the signal. If a wakeup pipe has been set up using
+ * InitWakeupPipe(), the handler also pokes it.
  */
 void InitWaitPgrp(void);
 
+/*! \brief Returns whether child processes are tracked using pidfds.
+ *
+ * This is the case on Linux 5.3 and newer. Only valid after InitWaitPgrp().
+ */
+int HavePidfds(void);
+
+/*! \brief Returns the pidfds of all running child processes.
+ *
+ * A pidfd becomes readable when the child exits, so these can be passed to
+ * poll() to wait for child termination; the child can then be reaped using
+ * WaitPgrp() or WaitProc().
+ *
+ * \param fds Array that receives the file descriptors.
+ * \param max_fds The size of the array.
+ * \return The number of file descriptors returned.
+ */
+int GetChildPidfds(int *fds, int max_fds);
+
 /*! \brief Fork a subprocess, but do not inherit our signal handlers.
  *
- * Otherwise behaves exactly like fork().
+ * Otherwise behaves exactly like fork(). If supported, the child process is
+ * tracked using a pidfd until it is reaped by WaitPgrp() or WaitProc(). If a
+ * pidfd was expected but could not be opened, the child is killed and this
+ * fails.
  */
 pid_t ForkWithoutSigHandlers(void);
 
@@ -42,6 +67,11 @@ pid_t ForkWithoutSigHandlers(void);
  * leader. The process group will never die, unless killed using KillPgrp (which
  * WaitPgrp calls implicitly when the leader process terminates).
  *
+ * Unless our parent tracks us using a pidfd, this forks a pgrp_placeholder
+ * process that keeps the process group ID reserved until the group is killed.
+ * With a pidfd, this is not needed, as WaitPgrp kills the group before reaping
+ * the leader.
+ *
  * \return Zero if the operation succeeded.
  */
 void StartPgrp(void);
@@ -56,6 +86,44 @@ void StartPgrp(void);
  */
 int ExecvHelper(const char *path, const char *const argv[]);
 
+//! Options for SpawnHelper().
+typedef struct {
+  //! The FD to become stdin of the child, or -1 to inherit ours.
+  int stdin_fd;
+  //! The FD to become stdout of the child, or -1 to inherit ours.
+  int stdout_fd;
+  //! Whether the child should start a new process group, as by StartPgrp().
+  int new_pgrp;
+  //! NULL terminated list of NAME=VALUE assignments to add to the environment
+  //! of the child, or NULL.
+  const char *const *env;
+  //! Function to call in the child right before executing the helper, or
+  //! NULL. If set, the child is always started using fork().
+  void (*before_exec)(void);
+} SpawnOptions;
+
+/*! \brief Spawns a helper process.
+ *
+ * Does the same as ForkWithoutSigHandlers(), followed in the child by
+ * StartPgrp() if requested, setting up stdin, stdout and the environment,
+ * calling before_exec if set, and ExecvHelper().
+ *
+ * Where possible, this uses posix_spawn(), which unlike fork() does not need to
+ * copy our page tables (including all locked memory) and is thus faster.
+ * Otherwise, or if setting up posix_spawn() fails, it falls back to fork(); if
+ * posix_spawn() itself fails, e.g. as the helper cannot be executed, it does
+ * not try again.
+ *
+ * All other FDs that should not be inherited must be close-on-exec.
+ *
+ * \param path The helper to run, as in ExecvHelper().
+ * \param argv The arguments of the helper, as in ExecvHelper().
+ * \param options How to set up the child process.
+ * \return The PID of the child, or -1 if it could not be started.
+ */
+pid_t SpawnHelper(const char *path, const char *const argv[],
+                  const SpawnOptions *options);
+
 /*! \brief Kills the given process group.
  *
  * \param pid The process group ID.
@@ -0,0 +1,92 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "wakeup_pipe.h"
+
+#include <errno.h>   // for errno, EINTR
+#include <fcntl.h>   // for fcntl, FD_CLOEXEC, F_GETFD, F_GETFL, O_NONBLOCK
+#include <unistd.h>  // for pipe, read, write
+
+#include "logging.h"  // for LogErrno
+
+//! The read and write ends of the wakeup pipe, or -1 if not initialized.
+static int wakeup_pipe[2] = {-1, -1};
+
+static int SetNonblockingCloexec(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    LogErrno("fcntl(O_NONBLOCK)");
+    return -1;
+  }
+  flags = fcntl(fd, F_GETFD);
+  if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+    LogErrno("fcntl(FD_CLOEXEC)");
+    return -1;
+  }
+  return 0;
+}
+
+int InitWakeupPipe(void) {
+  if (wakeup_pipe[0] != -1) {
+    return 0;
+  }
+  int fds[2];
+  if (pipe(fds)) {
+    LogErrno("pipe");
+    return -1;
+  }
+  // Both ends must be nonblocking: the writer must never block a signal
+  // handler, and the reader drains until EAGAIN.
+  if (SetNonblockingCloexec(fds[0]) || SetNonblockingCloexec(fds[1])) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  wakeup_pipe[1] = fds[1];
+  wakeup_pipe[0] = fds[0];
+  return 0;
+}
+
+void PokeWakeupPipe(void) {
+  int fd = wakeup_pipe[1];
+  if (fd == -1) {
+    return;
+  }
+  int errno_save = errno;
+  char c = 0;
+  // A full pipe is fine - the reader will wake up anyway.
+  (void)!write(fd, &c, 1);
+  errno = errno_save;
+}
+
+int GetWakeupPipeFd(void) { return wakeup_pipe[0]; }
+
+void DrainWakeupPipe(void) {
+  int fd = wakeup_pipe[0];
+  if (fd == -1) {
+    return;
+  }
+  char buf[64];
+  for (;;) {
+    ssize_t got = read(fd, buf, sizeof(buf));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < (ssize_t)sizeof(buf)) {
+      break;
+    }
+  }
+}
@@ -0,0 +1,51 @@
+/*
+Copyright 2018 Google Inc. All rights reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef WAKEUP_PIPE_H
+#define WAKEUP_PIPE_H
+
+/*! \brief Creates the wakeup pipe.
+ *
+ * The wakeup pipe is a "self-pipe" that signal handlers write to, so that an
+ * event loop sleeping in poll() reliably notices signals even if they arrive
+ * right before it goes to sleep.
+ *
+ * \return Zero if the operation succeeded.
+ */
+int InitWakeupPipe(void);
+
+/*! \brief Wakes up the event loop.
+ *
+ * This can be used from a signal handler. Does nothing if InitWakeupPipe() has
+ * not been called.
+ */
+void PokeWakeupPipe(void);
+
+/*! \brief Returns the file descriptor to wait on for wakeups.
+ *
+ * \return The read end of the wakeup pipe, or -1 if there is none. As poll()
+ *   ignores negative file descriptors, the return value can always be passed
+ *   to poll().
+ */
+int GetWakeupPipeFd(void);
+
+/*! \brief Consumes all pending wakeups.
+ *
+ * Should be called by the event loop after poll() returned.
+ */
+void DrainWakeupPipe(void);
+
+#endif
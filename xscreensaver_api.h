@@ -19,21 +19,28 @@ limitations under the License.
 
 #include <X11/X.h>  // for Window
 
-/*! \brief Export the given window ID to the environment for a saver/auth child.
+//! The buffer size needed by FormatWindowIDEnv() and FormatSaverIndexEnv().
+#define XSCREENSAVER_ENV_SIZE 64
+
+/*! \brief Formats the environment variable passing the window ID to a
+ * saver/auth child.
  *
- * This simply sets $XSCREENSAVER_WINDOW.
+ * This simply formats XSCREENSAVER_WINDOW=w, for SpawnOptions.env.
  *
+ * \param buf The buffer to write to, of size XSCREENSAVER_ENV_SIZE.
  * \param w The window the child should draw on.
  */
-void ExportWindowID(Window w);
+void FormatWindowIDEnv(char *buf, Window w);
 
-/*! \brief Export the given saver index to the environment for a saver/auth child.
+/*! \brief Formats the environment variable passing the saver index to a saver
+ * child.
  *
- * This simply sets $XSCREENSAVER_SAVER_INDEX.
+ * This simply formats XSCREENSAVER_SAVER_INDEX=index, for SpawnOptions.env.
  *
+ * \param buf The buffer to write to, of size XSCREENSAVER_ENV_SIZE.
  * \param index The index of the saver.
  */
-void ExportSaverIndex(int index);
+void FormatSaverIndexEnv(char *buf, int index);
 
 /*! \brief Reads the window ID to draw on from the environment.
  *